@@ -0,0 +1,267 @@
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cstdio>
+#include <cstdint>
+#include <optional>
+#include "asyncio/generator.hpp"
+#include "asyncio/pipeline.hpp"
+
+using namespace asyncio;
+
+// Cost per element of stepping a generator directly, which the compiler can inline,
+// against stepping it through the type-erased abstract_fiber interface,
+// of a map/filter/take pipeline as fused adaptors against one coroutine per stage,
+// of pulling values in batches from generators that yield one value or a chunk at a time,
+// of the range iterator against the former optional-caching one,
+// of copying large yielded values out with next() against borrowing them with next_ref(),
+// and of yielding from the innermost of nested generators.
+
+constexpr int64_t element_count = 20000000;
+
+generator<int64_t> iota(int64_t n) {
+  for(int64_t i = 0; i < n; i ++) {
+    co_yield i;
+  }
+}
+
+generator<int64_t> squares(int64_t n) {
+  for(int64_t i = 0; i < n; i ++) {
+    co_yield i * i % 7;
+  }
+}
+
+int64_t sum_next(generator<int64_t>& gen) {
+  int64_t sum = 0;
+  for(auto v = gen.next(); v.has_value(); v = gen.next()) {
+    sum += v.value();
+  }
+  return sum;
+}
+
+int64_t sum_range(generator<int64_t>& gen) {
+  int64_t sum = 0;
+  for(auto v: gen) {
+    sum += v;
+  }
+  return sum;
+}
+
+// Yields n values from the innermost of depth nested generators
+generator<int64_t> nested(int depth, int64_t n) {
+  if(depth == 0) {
+    for(int64_t i = 0; i < n; i ++) {
+      co_yield i;
+    }
+  } else {
+    co_await nested(depth - 1, n);
+  }
+}
+
+struct packet {
+  std::array<char, 1024> payload;
+  int64_t seq;
+};
+
+generator<packet> packets(int64_t n) {
+  packet p{};
+  for(int64_t i = 0; i < n; i ++) {
+    p.seq = i;
+    co_yield p;
+  }
+}
+
+// Yields the same sequence as iota() a chunk at a time
+generator<int64_t> iota_chunks(int64_t n) {
+  std::array<int64_t, 256> chunk;
+  for(int64_t i = 0; i < n; i += chunk.size()) {
+    auto size = std::min<int64_t>(chunk.size(), n - i);
+    for(int64_t j = 0; j < size; j ++) {
+      chunk[j] = i + j;
+    }
+    co_yield elements_of(std::span(chunk.data(), size));
+  }
+}
+
+int64_t sum_batches(generator<int64_t>& gen) {
+  std::array<int64_t, 256> batch;
+  int64_t sum = 0;
+  for(size_t n = gen.next_batch(batch); n > 0; n = gen.next_batch(batch)) {
+    for(size_t i = 0; i < n; i ++) {
+      sum += batch[i];
+    }
+  }
+  return sum;
+}
+
+// The same stages as a pipeline, written as one coroutine per stage
+generator<int64_t> map_stage(generator<int64_t> upstream) {
+  for(auto v: upstream) {
+    co_yield v * 3;
+  }
+}
+
+generator<int64_t> filter_stage(generator<int64_t> upstream) {
+  for(auto v: upstream) {
+    if(v % 2 == 0) {
+      co_yield v;
+    }
+  }
+}
+
+generator<int64_t> take_stage(generator<int64_t> upstream, int64_t n) {
+  for(auto v: upstream) {
+    if(n -- == 0) {
+      break;
+    }
+    co_yield v;
+  }
+}
+
+// The iterator before generators became ranges: it cached a copy in std::optional, compared
+// against a bool end() through is_done(), and copied the value again on dereference
+template<typename Gen>
+struct legacy_iterator {
+  Gen* gen;
+  std::optional<typename Gen::yield_type> value;
+
+  legacy_iterator& operator++() {
+    value = gen->next();
+    return *this;
+  }
+
+  bool operator!=(bool) {
+    return !gen->is_done();
+  }
+
+  typename Gen::yield_type operator*() {
+    return value.value();
+  }
+};
+
+template<typename Gen, typename Fn>
+void legacy_for_each(Gen& gen, Fn&& fn) {
+  for(legacy_iterator<Gen> it{&gen, gen.next()}; it != false; ++it) {
+    fn(*it);
+  }
+}
+
+[[gnu::noinline]] int64_t sum_fiber(abstract_fiber<int64_t>& fib) {
+  int64_t sum = 0;
+  for(auto v = fib.next(); v.has_value(); v = fib.next()) {
+    sum += v.value();
+  }
+  return sum;
+}
+
+template<typename Fn>
+void measure(const char* name, Fn&& fn) {
+  auto start = std::chrono::steady_clock::now();
+  int64_t sum = fn();
+  auto elapsed = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+  printf("%-24s %10.2f ns/element  (sum %lld)\n", name, elapsed / element_count, static_cast<long long>(sum));
+}
+
+int main() {
+  measure("crtp next()", [] {
+    auto gen = iota(element_count);
+    return sum_next(gen);
+  });
+  measure("crtp range-for", [] {
+    auto gen = iota(element_count);
+    return sum_range(gen);
+  });
+  measure("abstract_fiber next()", [] {
+    fiber<generator<int64_t>> fib(iota(element_count));
+    return sum_fiber(fib);
+  });
+  measure("crtp next() (modulo)", [] {
+    auto gen = squares(element_count);
+    return sum_next(gen);
+  });
+  measure("abstract_fiber (modulo)", [] {
+    fiber<generator<int64_t>> fib(squares(element_count));
+    return sum_fiber(fib);
+  });
+  measure("next_batch()", [] {
+    auto gen = iota(element_count);
+    return sum_batches(gen);
+  });
+  measure("chunks next()", [] {
+    auto gen = iota_chunks(element_count);
+    return sum_next(gen);
+  });
+  measure("chunks next_batch()", [] {
+    auto gen = iota_chunks(element_count);
+    return sum_batches(gen);
+  });
+  measure("coroutine stages", [] {
+    auto gen = take_stage(filter_stage(map_stage(iota(element_count))), element_count / 2);
+    return sum_next(gen);
+  });
+  measure("fused pipeline", [] {
+    auto pipeline = iota(element_count)
+                  | map([](int64_t v) { return v * 3; })
+                  | filter([](int64_t v) { return v % 2 == 0; })
+                  | take(element_count / 2);
+    int64_t sum = 0;
+    for(auto v: pipeline) {
+      sum += v;
+    }
+    return sum;
+  });
+  measure("legacy iterator", [] {
+    auto gen = iota(element_count);
+    int64_t sum = 0;
+    legacy_for_each(gen, [&](int64_t v) { sum += v; });
+    return sum;
+  });
+  measure("ranges::for_each", [] {
+    int64_t sum = 0;
+    std::ranges::for_each(iota(element_count), [&](int64_t v) { sum += v; });
+    return sum;
+  });
+  measure("1KiB legacy iterator", [] {
+    auto gen = packets(element_count);
+    int64_t sum = 0;
+    legacy_for_each(gen, [&](const packet& p) { sum += p.seq; });
+    return sum;
+  });
+  measure("1KiB ranges::for_each", [] {
+    int64_t sum = 0;
+    std::ranges::for_each(packets(element_count), [&](const packet& p) { sum += p.seq; });
+    return sum;
+  });
+  measure("1KiB packets next()", [] {
+    auto gen = packets(element_count);
+    int64_t sum = 0;
+    for(auto p = gen.next(); p.has_value(); p = gen.next()) {
+      sum += p->seq;
+    }
+    return sum;
+  });
+  measure("1KiB packets next_ref()", [] {
+    auto gen = packets(element_count);
+    int64_t sum = 0;
+    for(auto p = gen.next_ref(); p; p = gen.next_ref()) {
+      sum += p->seq;
+    }
+    return sum;
+  });
+  measure("1KiB packets range-for", [] {
+    int64_t sum = 0;
+    for(auto& p: packets(element_count)) {
+      sum += p.seq;
+    }
+    return sum;
+  });
+  for(int depth: {1, 4, 16, 64}) {
+    char name[32];
+    snprintf(name, sizeof(name), "nested depth %d", depth);
+    measure(name, [depth] {
+      auto gen = nested(depth, element_count);
+      return sum_next(gen);
+    });
+  }
+  return 0;
+}
@@ -0,0 +1,53 @@
+#include <chrono>
+#include <cstdio>
+#include <cstdint>
+#include "asyncio/generator.hpp"
+#include "asyncio/pipeline.hpp"
+#include "asyncio/prefetch.hpp"
+#include "bench_util.hpp"
+
+using namespace asyncio;
+
+// An expensive producer feeding an expensive consumer, run inline on one thread
+// against prefetched on a worker thread with several ring depths.
+// With two free cores, the prefetched time approaches the larger of the two costs instead of their sum.
+
+constexpr int64_t element_count = 200000;
+
+// Stands for decoding or signing a packet
+generator<uint64_t> produce(int64_t n) {
+  for(int64_t i = 0; i < n; i ++) {
+    co_yield spin(i, 2000);
+  }
+}
+
+template<typename Range>
+uint64_t consume(Range&& range) {
+  uint64_t acc = 0;
+  for(auto v: range) {
+    acc ^= spin(v, 2000);
+  }
+  return acc;
+}
+
+template<typename Fn>
+void measure(const char* name, Fn&& fn) {
+  auto start = std::chrono::steady_clock::now();
+  auto acc = fn();
+  auto elapsed = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+  printf("%-20s %10.1f ns/element  (acc %llx)\n", name, elapsed / element_count, static_cast<unsigned long long>(acc));
+}
+
+int main() {
+  measure("inline", [] {
+    return consume(produce(element_count));
+  });
+  for(size_t depth: {1, 16, 256}) {
+    char name[32];
+    snprintf(name, sizeof(name), "prefetch depth %zu", depth);
+    measure(name, [depth] {
+      return consume(produce(element_count) | prefetch(depth));
+    });
+  }
+  return 0;
+}
@@ -0,0 +1,71 @@
+#include <chrono>
+#include <cstdio>
+#include <vector>
+#include "asyncio/coroutine.hpp"
+#include "asyncio/sleep_engine.hpp"
+#include "asyncio/task_group.hpp"
+#include "bench_util.hpp"
+
+using namespace asyncio;
+using namespace std::chrono_literals;
+
+// Keep-alive latency while bulk fetches saturate the loop: the keep-alives run in the same class as the bulk
+// tasks, then in a higher one. Latency is from the deadline of a wakeup to its resumption.
+
+constexpr int bulk_count = 200;
+constexpr int keepalive_count = 500;
+
+volatile uint64_t sink;
+
+task<void> bulk_fetch(sleep_engine& engine, bool& stop) {
+  uint64_t x = 1;
+  while(!stop) {
+    // About 10us of work per packet
+    x = spin(x, 5000);
+    co_await engine.sleep(0ms);
+  }
+  sink = x;
+}
+
+task<void> keepalive(sleep_engine& engine, bool& stop) {
+  for(int i = 0; i < keepalive_count; i ++) {
+    co_await engine.sleep(1ms);
+  }
+  stop = true;
+}
+
+void measure(const char* name, priority keepalive_prio) {
+  sleep_engine engine;
+  engine.set_latency_metrics(true);
+  bool stop = false;
+  for(int i = 0; i < bulk_count; i ++) {
+    auto t = bulk_fetch(engine, stop);
+    t.set_priority(priority::low);
+    spawn(engine, std::move(t));
+  }
+  auto k = keepalive(engine, stop);
+  engine.schedule_task(k, 0ms, keepalive_prio);
+  engine.run();
+
+  auto print = [&](const char* cls, priority prio) {
+    auto& stats = engine.latency_of(prio);
+    printf("%-22s %-10s %10llu %10.1f %10.1f %10.1f\n", name, cls,
+           static_cast<unsigned long long>(stats.count),
+           std::chrono::duration<double, std::micro>(stats.percentile(50)).count(),
+           std::chrono::duration<double, std::micro>(stats.percentile(99)).count(),
+           std::chrono::duration<double, std::micro>(stats.max).count());
+  };
+  if(keepalive_prio == priority::low) {
+    print("both", priority::low);
+  } else {
+    print("keepalive", keepalive_prio);
+    print("bulk", priority::low);
+  }
+}
+
+int main() {
+  printf("%-22s %-10s %10s %10s %10s %10s\n", "keep-alive class", "class", "resumes", "p50 us", "p99 us", "max us");
+  measure("same as bulk (low)", priority::low);
+  measure("high", priority::high);
+  return 0;
+}
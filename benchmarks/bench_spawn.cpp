@@ -0,0 +1,52 @@
+#include <chrono>
+#include <cstdio>
+#include "asyncio/coroutine.hpp"
+#include "asyncio/sleep_engine.hpp"
+#include "asyncio/task_group.hpp"
+
+using namespace asyncio;
+using namespace std::chrono_literals;
+
+// Cost of detached tasks: spawning short-lived handlers, and the engine round time once they finished.
+
+constexpr int round_count = 100000;
+
+int handled = 0;
+
+task<void> handler(sleep_engine& engine) {
+  co_await engine.sleep(0ms);
+  handled ++;
+}
+
+task<void> ticker(sleep_engine& engine) {
+  for(int i = 0; i < round_count; i ++) {
+    co_await engine.sleep(0ms);
+  }
+}
+
+void measure(int spawn_count) {
+  sleep_engine engine;
+  auto start = std::chrono::steady_clock::now();
+  for(int i = 0; i < spawn_count; i ++) {
+    spawn(engine, handler(engine));
+  }
+  engine.run();
+  auto spawned = std::chrono::steady_clock::now();
+
+  auto t = ticker(engine);
+  engine.schedule_task(t);
+  engine.run();
+  auto ticked = std::chrono::steady_clock::now();
+
+  double spawn_ns = spawn_count ? std::chrono::duration<double, std::nano>(spawned - start).count() / spawn_count : 0;
+  double round_ns = std::chrono::duration<double, std::nano>(ticked - spawned).count() / round_count;
+  printf("%10d %16.1f %16.1f\n", spawn_count, spawn_ns, round_ns);
+}
+
+int main() {
+  printf("%10s %16s %16s\n", "spawned", "ns/handler", "ns/round after");
+  for(int count: {0, 1000, 100000}) {
+    measure(count);
+  }
+  return handled > 0 ? 0 : 1;
+}
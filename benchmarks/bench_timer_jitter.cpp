@@ -0,0 +1,38 @@
+#include <chrono>
+#include <cstdio>
+#include <vector>
+#include "asyncio/coroutine.hpp"
+#include "asyncio/sleep_engine.hpp"
+#include "asyncio/epoll_engine.hpp"
+#include "bench_util.hpp"
+
+using namespace asyncio;
+using namespace std::chrono_literals;
+
+// Wakeup jitter of engine.sleep(): how late a coroutine resumes after its deadline.
+
+constexpr int sample_count = 200;
+
+template<typename Engine>
+void measure(const char* name, duration length) {
+  Engine engine;
+  std::vector<double> delays;
+  delays.reserve(sample_count);
+  auto t = sleeper(engine, length, sample_count, delays);
+  engine.schedule_task(t);
+  engine.run();
+
+  auto summary = summarize(delays);
+  printf("%-14s %8lld %10.1f %10.1f %10.1f %10.1f\n", name,
+         static_cast<long long>(std::chrono::duration_cast<std::chrono::microseconds>(length).count()),
+         summary.mean, summary.p50, summary.p99, summary.max);
+}
+
+int main() {
+  printf("%-14s %8s %10s %10s %10s %10s\n", "engine", "sleep us", "mean us", "p50 us", "p99 us", "max us");
+  for(auto length: {100us, 250us, 500us, 1000us}) {
+    measure<sleep_engine>("sleep_engine", length);
+    measure<epoll_engine>("epoll_engine", length);
+  }
+  return 0;
+}
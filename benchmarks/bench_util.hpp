@@ -0,0 +1,53 @@
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <vector>
+#include "asyncio/coroutine.hpp"
+
+// Helpers shared by the benchmarks.
+
+/** @brief Burns CPU on arithmetic the compiler cannot fold; the cost is linear in rounds.
+ */
+inline uint64_t spin(uint64_t x, int rounds) {
+  for(int i = 0; i < rounds; i ++) {
+    x = x * 6364136223846793005ull + 1442695040888963407ull;
+  }
+  return x;
+}
+
+/** @brief Sleeps count times for length, recording how many microseconds each wakeup comes after its deadline.
+ */
+template<typename Engine>
+asyncio::task<void> sleeper(Engine& engine, asyncio::duration length, int count, std::vector<double>& delays) {
+  for(int i = 0; i < count; i ++) {
+    auto deadline = std::chrono::steady_clock::now() + length;
+    co_await engine.sleep(length);
+    delays.push_back(std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - deadline).count());
+  }
+}
+
+struct delay_summary {
+  double mean;
+  double p50;
+  double p99;
+  double max;
+};
+
+/** @brief Sorts the samples and summarizes them.
+ *  @pre samples is not empty.
+ */
+inline delay_summary summarize(std::vector<double>& samples) {
+  std::sort(samples.begin(), samples.end());
+  double sum = 0;
+  for(auto s: samples) {
+    sum += s;
+  }
+  return delay_summary{
+    .mean = sum / samples.size(),
+    .p50 = samples[samples.size() / 2],
+    .p99 = samples[samples.size() * 99 / 100],
+    .max = samples.back(),
+  };
+}
@@ -0,0 +1,99 @@
+#include <chrono>
+#include <cstdio>
+#include <ctime>
+#include <thread>
+#include <vector>
+#include "asyncio/coroutine.hpp"
+#include "asyncio/sleep_engine.hpp"
+#include "asyncio/epoll_engine.hpp"
+#include "bench_util.hpp"
+
+using namespace asyncio;
+using namespace std::chrono_literals;
+
+// Ready-to-resume latency under each wait policy: how late a timer resumes after its deadline,
+// and how long a handle posted from another thread waits before it resumes. CPU time shows the cost.
+
+constexpr int sample_count = 300;
+
+template<typename Engine>
+task<void> timer_wakeups(Engine& engine, std::vector<double>& delays) {
+  return sleeper(engine, 200us, sample_count, delays);
+}
+
+// Resumed on the engine by a post() from a helper thread after a pause
+template<typename Engine>
+struct posted_from_thread {
+  Engine& engine;
+  std::thread helper;
+  std::chrono::steady_clock::time_point posted_at;
+
+  constexpr bool await_ready() const noexcept {
+    return false;
+  }
+
+  void await_suspend(coroutine_handle<> caller) {
+    engine.add_work();
+    helper = std::thread([this, caller] {
+      std::this_thread::sleep_for(200us);
+      posted_at = std::chrono::steady_clock::now();
+      engine.post(caller);
+      engine.remove_work();
+    });
+  }
+
+  double await_resume() {
+    auto delay = std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - posted_at).count();
+    helper.join();
+    return delay;
+  }
+};
+
+template<typename Engine>
+task<void> poster(Engine& engine, std::vector<double>& delays) {
+  for(int i = 0; i < sample_count; i ++) {
+    delays.push_back(co_await posted_from_thread<Engine>{engine, {}, {}});
+  }
+}
+
+void print(const char* engine_name, const char* policy, const char* what, std::vector<double>& delays, double cpu) {
+  auto summary = summarize(delays);
+  printf("%-14s %-16s %-6s %10.1f %10.1f %10.1f %8.0f%%\n", engine_name, policy, what,
+         summary.p50, summary.p99, summary.max, cpu * 100);
+}
+
+template<typename Engine, typename Body>
+void measure(const char* engine_name, const char* policy_name, wait_policy policy, const char* what, Body body) {
+  Engine engine;
+  engine.set_wait_policy(policy);
+  std::vector<double> delays;
+  delays.reserve(sample_count);
+  auto t = body(engine, delays);
+  engine.schedule_task(t);
+  auto wall_start = std::chrono::steady_clock::now();
+  auto cpu_start = std::clock();
+  engine.run();
+  double cpu = double(std::clock() - cpu_start) / CLOCKS_PER_SEC;
+  double wall = std::chrono::duration<double>(std::chrono::steady_clock::now() - wall_start).count();
+  print(engine_name, policy_name, what, delays, cpu / wall);
+}
+
+template<typename Engine>
+void measure_all(const char* engine_name) {
+  std::pair<const char*, wait_policy> policies[] = {
+    {"block", {wait_mode::block, 0us}},
+    {"spin 50us", {wait_mode::spin_then_block, 50us}},
+    {"busy poll", {wait_mode::busy_poll, 0us}},
+  };
+  for(auto& [name, policy]: policies) {
+    measure<Engine>(engine_name, name, policy, "timer", timer_wakeups<Engine>);
+    measure<Engine>(engine_name, name, policy, "post", poster<Engine>);
+  }
+}
+
+int main() {
+  printf("%-14s %-16s %-6s %10s %10s %10s %9s\n", "engine", "policy", "wakeup", "p50 us", "p99 us", "max us", "cpu");
+  measure_all<sleep_engine>("sleep_engine");
+  measure_all<epoll_engine>("epoll_engine");
+  return 0;
+}
@@ -0,0 +1,60 @@
+#include <chrono>
+#include <cstdio>
+#include <thread>
+#include <vector>
+#include "asyncio/coroutine.hpp"
+#include "asyncio/work_stealing_engine.hpp"
+#include "bench_util.hpp"
+
+using namespace asyncio;
+using namespace std::chrono_literals;
+
+// Throughput of work_stealing_engine against the number of worker threads.
+// cpu: every task spins on arithmetic between a few yields to the engine.
+// sleep: every task sleeps several times, so workers mostly wait for timers.
+
+constexpr int task_count = 2000;
+
+task<uint64_t> cpu_task(work_stealing_engine& engine, uint64_t seed) {
+  for(int i = 0; i < 4; i ++) {
+    seed = spin(seed, 50000);
+    co_await engine.sleep(0ms);
+  }
+  co_return seed;
+}
+
+task<uint64_t> sleep_task(work_stealing_engine& engine, uint64_t seed) {
+  for(int i = 0; i < 5; i ++) {
+    co_await engine.sleep(2ms);
+    seed = spin(seed, 500);
+  }
+  co_return seed;
+}
+
+template<typename Fn>
+double measure(size_t threads, Fn&& make_task) {
+  work_stealing_engine engine(threads);
+  std::vector<task<uint64_t>> tasks;
+  tasks.reserve(task_count);
+  for(int i = 0; i < task_count; i ++) {
+    tasks.push_back(make_task(engine, i));
+  }
+  auto start = std::chrono::steady_clock::now();
+  for(auto& t: tasks) {
+    engine.schedule_task(t);
+  }
+  engine.run();
+  auto elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+  return task_count / elapsed;
+}
+
+int main() {
+  size_t max_threads = std::max(1u, std::thread::hardware_concurrency());
+  printf("%8s %16s %16s\n", "threads", "cpu tasks/s", "sleep tasks/s");
+  for(size_t threads = 1; threads <= max_threads; threads *= 2) {
+    auto cpu = measure(threads, cpu_task);
+    auto sleep = measure(threads, sleep_task);
+    printf("%8zu %16.0f %16.0f\n", threads, cpu, sleep);
+  }
+  return 0;
+}
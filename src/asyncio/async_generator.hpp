@@ -0,0 +1,167 @@
+#pragma once
+
+#include <optional>
+#include <exception>
+#include <utility>
+#include "common.hpp"
+#include "utils.hpp"
+#include "trace.hpp"
+#include "frame_allocator.hpp"
+#include "coroutine.hpp"
+
+namespace asyncio {
+
+/** @brief A generator that runs on an engine: its body can co_await timers and tasks as well as co_yield.
+ *         It is consumed from a coroutine with co_await gen.next(), which suspends the consumer
+ *         until the next value is yielded, so only one value is produced ahead of the consumer.
+ *         The consumer and the generator hand over to each other by symmetric transfer.
+ */
+template<typename YieldType>
+struct async_generator {
+  struct promise_type: public pooled_frame {
+    // Inherited from the first consumer unless set_engine() is called
+    abstract_engine* engine_ptr;
+    // Inherited from the first consumer, so that its sleeps and the tasks it awaits can be cancelled,
+    // and run in the consumer's priority class
+    cancellation_token token;
+    std::optional<priority> prio;
+    // The coroutine waiting in next()
+    coroutine_handle<> consumer;
+    std::optional<YieldType> yielded_value;
+    std::exception_ptr error;
+    bool done;
+    uint64_t promise_id;
+
+    promise_type():
+      engine_ptr(nullptr), token(), prio(), consumer(), yielded_value(std::nullopt), error(), done(false),
+      promise_id(generate_id())
+    {
+      ASYNCIO_TRACE("AsyncGenerator (", promise_id, ") created");
+    }
+
+    async_generator get_return_object() {
+      return async_generator(coroutine_handle<promise_type>::from_promise(*this));
+    }
+
+    constexpr auto initial_suspend() {
+      return suspend_always();
+    }
+
+    /** @brief Transfers back to the consumer when a value is yielded or the generator finishes.
+     */
+    struct return_to_consumer {
+      constexpr bool await_ready() const noexcept {
+        return false;
+      }
+
+      coroutine_handle<> await_suspend(coroutine_handle<promise_type> self) noexcept {
+        return std::exchange(self.promise().consumer, nullptr);
+      }
+
+      constexpr void await_resume() const noexcept {}
+    };
+
+    template<CONVERTIBLE_TO(YieldType) From>
+    return_to_consumer yield_value(From&& value) {
+      ASYNCIO_TRACE("AsyncGenerator (", promise_id, ") yielded ", value);
+      yielded_value = std::forward<From>(value);
+      return return_to_consumer{};
+    }
+
+    void return_void() {
+      ASYNCIO_TRACE("AsyncGenerator (", promise_id, ") returned void");
+      done = true;
+    }
+
+    /** @brief Suspends to retain the frame, which is destroyed with the async_generator object.
+     */
+    return_to_consumer final_suspend() noexcept {
+      ASYNCIO_TRACE("AsyncGenerator (", promise_id, ") final_suspend");
+      return return_to_consumer{};
+    }
+
+    void unhandled_exception() {
+      error = std::current_exception();
+      done = true;
+    }
+  };
+
+  /** @brief Resumes the generator until it yields the next value.
+   */
+  struct next_awaiter {
+    coroutine_handle<promise_type> handle;
+
+    bool await_ready() const noexcept {
+      return handle.promise().done;
+    }
+
+    template<typename P>
+    coroutine_handle<> await_suspend(coroutine_handle<P> caller) {
+      auto& promise = handle.promise();
+      if(promise.consumer) {
+        throw double_await{};
+      }
+      if(!promise.engine_ptr) {
+        promise.engine_ptr = caller.promise().engine_ptr;
+      }
+      if(!promise.token) {
+        promise.token = token_of(caller);
+      }
+      if(!promise.prio) {
+        promise.prio = priority_of(caller);
+      }
+      promise.consumer = caller;
+      return handle;
+    }
+
+    /** @return The yielded value, or std::nullopt if the generator has finished.
+     */
+    std::optional<YieldType> await_resume() {
+      auto& promise = handle.promise();
+      if(promise.error) {
+        std::rethrow_exception(std::exchange(promise.error, nullptr));
+      }
+      if(promise.done) {
+        return std::nullopt;
+      }
+      return std::exchange(promise.yielded_value, std::nullopt);
+    }
+  };
+
+  coroutine_handle<promise_type> handle;
+
+  async_generator(coroutine_handle<promise_type> handle):
+    handle(handle)
+  {}
+
+  async_generator(const async_generator&) = delete;
+  void operator=(const async_generator&) = delete;
+
+  async_generator(async_generator&& rhs) noexcept:
+    handle(std::exchange(rhs.handle, nullptr))
+  {}
+
+  ~async_generator() {
+    if(handle) {
+      ASYNCIO_TRACE("AsyncGenerator (", handle.promise().promise_id, ") destroyed");
+      handle.destroy();
+    }
+  }
+
+  void set_engine(abstract_engine& engine) {
+    handle.promise().engine_ptr = &engine;
+  }
+
+  bool is_done() const noexcept {
+    return handle.promise().done;
+  }
+
+  /** @brief Awaited by a consumer coroutine: co_await gen.next().
+   *  @pre No other coroutine is awaiting the generator.
+   */
+  next_awaiter next() {
+    return next_awaiter{handle};
+  }
+};
+
+} // namespace asyncio
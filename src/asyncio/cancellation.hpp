@@ -0,0 +1,128 @@
+#pragma once
+
+#include "common.hpp"
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <utility>
+
+namespace asyncio {
+
+/** @brief A callback run when cancellation is requested, linked into the token's state.
+ *         The node lives in the object waiting for cancellation (e.g. an awaiter), so registering
+ *         does not allocate. fn runs on the thread calling request_cancellation().
+ */
+struct cancellation_callback {
+  void (*fn)(void* context);
+  void* context;
+  cancellation_callback* prev;
+  cancellation_callback* next;
+};
+
+/** @brief State shared by a cancellation_source and its tokens.
+ */
+struct cancellation_state {
+  std::atomic<bool> requested;
+  // Protects the list, and is held while the callbacks run so that a deregistration waits for them
+  std::mutex mutex;
+  cancellation_callback* callbacks;
+
+  cancellation_state():
+    requested(false), mutex(), callbacks(nullptr)
+  {}
+};
+
+/** @brief A view of a cancellation_source, passed down to the operations it may cancel.
+ *         An empty token can never be cancelled. Tasks inherit the token of their first awaiter.
+ */
+struct cancellation_token {
+  std::shared_ptr<cancellation_state> state;
+
+  explicit operator bool() const noexcept {
+    return static_cast<bool>(state);
+  }
+
+  bool is_cancellation_requested() const noexcept {
+    return state && state->requested.load(std::memory_order_acquire);
+  }
+
+  /** @brief Throws operation_cancelled if cancellation is requested.
+   */
+  void throw_if_cancellation_requested() const {
+    if(is_cancellation_requested()) {
+      throw operation_cancelled{};
+    }
+  }
+
+  /** @brief Registers node to be called on cancellation.
+   *  @return false if cancellation is already requested, in which case node is not registered.
+   */
+  bool register_callback(cancellation_callback& node) const {
+    std::lock_guard<std::mutex> lock(state->mutex);
+    if(state->requested.load(std::memory_order_relaxed)) {
+      return false;
+    }
+    node.prev = nullptr;
+    node.next = state->callbacks;
+    if(node.next) {
+      node.next->prev = &node;
+    }
+    state->callbacks = &node;
+    return true;
+  }
+
+  /** @brief Removes node if it is still registered, waiting for it to finish if it is running.
+   */
+  void deregister_callback(cancellation_callback& node) const {
+    std::lock_guard<std::mutex> lock(state->mutex);
+    if(node.prev) {
+      node.prev->next = node.next;
+    } else if(state->callbacks == &node) {
+      state->callbacks = node.next;
+    } else {
+      // Already called
+      return;
+    }
+    if(node.next) {
+      node.next->prev = node.prev;
+    }
+  }
+};
+
+/** @brief The owner side: request_cancellation() cancels every operation holding one of its tokens.
+ */
+struct cancellation_source {
+  std::shared_ptr<cancellation_state> state;
+
+  cancellation_source():
+    state(std::make_shared<cancellation_state>())
+  {}
+
+  cancellation_token token() const {
+    return cancellation_token{state};
+  }
+
+  bool is_cancellation_requested() const noexcept {
+    return state->requested.load(std::memory_order_acquire);
+  }
+
+  /** @brief Marks the token cancelled and runs the registered callbacks once.
+   *         The callbacks run on the calling thread; with a single-threaded engine, call this from its thread.
+   */
+  void request_cancellation() {
+    std::lock_guard<std::mutex> lock(state->mutex);
+    if(state->requested.exchange(true, std::memory_order_acq_rel)) {
+      return;
+    }
+    auto node = std::exchange(state->callbacks, nullptr);
+    while(node) {
+      auto next = node->next;
+      node->prev = nullptr;
+      node->next = nullptr;
+      node->fn(node->context);
+      node = next;
+    }
+  }
+};
+
+} // namespace asyncio
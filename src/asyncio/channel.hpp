@@ -0,0 +1,169 @@
+#pragma once
+
+#include <cstddef>
+#include <mutex>
+#include <optional>
+#include <utility>
+#include <vector>
+#include "common.hpp"
+#include "sync.hpp"
+
+namespace asyncio {
+
+/** @brief A bounded multi-producer multi-consumer channel between coroutines.
+ *         co_await ch.send(v) suspends while the buffer is full, which is the backpressure on the producer;
+ *         co_await ch.receive() suspends while it is empty. Both sides are served in FIFO order.
+ *         A value is handed directly to a waiting receiver, and a capacity of 0 makes every send a rendezvous.
+ *         The buffer is allocated once; waiting senders keep their value in their own frame.
+ */
+template<typename T>
+struct channel {
+  std::mutex mutex;
+  waiter_queue senders;
+  waiter_queue receivers;
+  std::vector<std::optional<T>> buffer;
+  size_t head;
+  size_t size;
+  bool closed;
+
+  explicit channel(size_t capacity):
+    mutex(), senders(), receivers(), buffer(capacity), head(0), size(0), closed(false)
+  {}
+
+  channel(const channel&) = delete;
+  void operator=(const channel&) = delete;
+
+  struct send_awaiter: public sync_awaiter<send_awaiter> {
+    channel& owner;
+    std::optional<T> value;
+    // Set if the channel is closed before the value is taken
+    bool rejected;
+
+    send_awaiter(channel& owner, T&& value):
+      sync_awaiter<send_awaiter>(owner.mutex, owner.senders), owner(owner), value(std::move(value)), rejected(false)
+    {}
+
+    bool try_complete() {
+      return owner.try_send_locked(value, rejected);
+    }
+
+    /** @throw channel_closed if the channel is closed, in which case the value is dropped.
+     */
+    void await_resume() {
+      this->finish_wait();
+      if(rejected) {
+        throw channel_closed{};
+      }
+    }
+  };
+
+  struct receive_awaiter: public sync_awaiter<receive_awaiter> {
+    channel& owner;
+    std::optional<T> value;
+
+    explicit receive_awaiter(channel& owner):
+      sync_awaiter<receive_awaiter>(owner.mutex, owner.receivers), owner(owner), value(std::nullopt)
+    {}
+
+    bool try_complete() {
+      return owner.try_receive_locked(value);
+    }
+
+    /** @return The value, or std::nullopt once the channel is closed and drained.
+     */
+    std::optional<T> await_resume() {
+      this->finish_wait();
+      return std::move(value);
+    }
+  };
+
+  send_awaiter send(T value) {
+    return send_awaiter(*this, std::move(value));
+  }
+
+  receive_awaiter receive() {
+    return receive_awaiter(*this);
+  }
+
+  /** @return false if the buffer is full and no receiver is waiting.
+   *  @throw channel_closed if the channel is closed.
+   */
+  bool try_send(T value) {
+    std::optional<T> slot(std::move(value));
+    bool rejected = false;
+    std::lock_guard<std::mutex> lock(mutex);
+    bool sent = try_send_locked(slot, rejected);
+    if(rejected) {
+      throw channel_closed{};
+    }
+    return sent;
+  }
+
+  /** @return std::nullopt if nothing is available right now, or the channel is closed and drained.
+   */
+  std::optional<T> try_receive() {
+    std::optional<T> value;
+    std::lock_guard<std::mutex> lock(mutex);
+    try_receive_locked(value);
+    return value;
+  }
+
+  /** @brief Wakes up every waiter: receivers get the remaining values, then std::nullopt;
+   *         waiting senders throw channel_closed.
+   */
+  void close() {
+    std::lock_guard<std::mutex> lock(mutex);
+    closed = true;
+    while(auto waiter = senders.pop_front()) {
+      static_cast<send_awaiter*>(waiter)->rejected = true;
+      wake(*waiter);
+    }
+    // Receivers only wait on an empty buffer
+    while(auto waiter = receivers.pop_front()) {
+      wake(*waiter);
+    }
+  }
+
+  bool try_send_locked(std::optional<T>& value, bool& rejected) {
+    if(closed) {
+      rejected = true;
+      return true;
+    }
+    if(auto waiter = receivers.pop_front()) {
+      static_cast<receive_awaiter*>(waiter)->value = std::move(value);
+      wake(*waiter);
+      return true;
+    }
+    if(size < buffer.size()) {
+      buffer[(head + size) % buffer.size()] = std::move(value);
+      size ++;
+      return true;
+    }
+    return false;
+  }
+
+  bool try_receive_locked(std::optional<T>& value) {
+    if(size > 0) {
+      value = std::move(buffer[head]);
+      buffer[head].reset();
+      head = (head + 1) % buffer.size();
+      size --;
+      // Refill the freed slot from the longest waiting sender
+      if(auto waiter = senders.pop_front()) {
+        buffer[(head + size) % buffer.size()] = std::move(static_cast<send_awaiter*>(waiter)->value);
+        size ++;
+        wake(*waiter);
+      }
+      return true;
+    }
+    if(auto waiter = senders.pop_front()) {
+      // Unbuffered: take the value from the sender
+      value = std::move(static_cast<send_awaiter*>(waiter)->value);
+      wake(*waiter);
+      return true;
+    }
+    return closed;
+  }
+};
+
+} // namespace asyncio
@@ -14,10 +14,12 @@ namespace asyncio {
 
 #if defined(__GNUC__) && (__GNUC__ >= 10)
 using std::coroutine_handle;
+using std::noop_coroutine;
 using std::suspend_always;
 using std::suspend_never;
 #else
 using std::experimental::coroutine_handle;
+using std::experimental::noop_coroutine;
 using std::experimental::suspend_always;
 using std::experimental::suspend_never;
 #endif
@@ -64,4 +66,16 @@ struct hanging_task: public std::exception{
   }
 };
 
+struct operation_cancelled: public std::exception{
+ constexpr const char* what() const noexcept override {
+   return "The operation is cancelled through its cancellation token.";
+  }
+};
+
+struct channel_closed: public std::exception{
+ constexpr const char* what() const noexcept override {
+   return "A value is sent to a closed channel.";
+  }
+};
+
 } // namespace asyncio
\ No newline at end of file
@@ -1,10 +1,11 @@
 #include "coroutine.hpp"
+#include <atomic>
 
 namespace asyncio {
 
 uint64_t generate_id() {
-  static uint64_t next_id = 0;
-  return ++ next_id;
+  static std::atomic<uint64_t> next_id = 0;
+  return next_id.fetch_add(1, std::memory_order_relaxed) + 1;
 }
 
 } // namespace asyncio
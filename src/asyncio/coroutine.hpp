@@ -2,156 +2,448 @@
 
 #include "common.hpp"
 #include "utils.hpp"
+#include "trace.hpp"
+#include "frame_allocator.hpp"
+#include "cancellation.hpp"
+#include "timer_heap.hpp"
 #include <optional>
-#include <list>
+#include <atomic>
+#include <cassert>
 #include <iostream>
 
 namespace asyncio {
 
-struct abstract_task {
-  virtual bool is_done() = 0;
-
-  virtual ~abstract_task(){}
-};
-
 struct abstract_engine {
   // Note: coroutine_handle is like a view, which does not hold ownership
-  virtual void schedule(coroutine_handle<> handle, msec tim) = 0;
+  // Engines without priority classes ignore prio.
+  virtual void schedule(coroutine_handle<> handle, time_point tim, priority prio = priority::normal) = 0;
+
+  /** @brief Schedules handle to be resumed as soon as possible, in class prio.
+   *         Unlike schedule(handle, asap), it is safe to call from any thread, and wakes up a sleeping engine.
+   */
+  virtual void post(coroutine_handle<> handle, priority prio = priority::normal) = 0;
+
+  /** @brief Counts work done outside of the engine, e.g. on another thread, that will post() back.
+   *         run() does not return while there is any. Both are safe to call from any thread.
+   */
+  virtual void add_work() noexcept = 0;
+
+  virtual void remove_work() noexcept = 0;
+
+  /** @brief Schedules entry.handle at entry.awake_at, so that it can be cancelled while it is pending.
+   *         The entry must stay alive until the handle is resumed.
+   */
+  virtual void schedule_timer(timer_entry& entry) = 0;
 
-  virtual bool is_scheduled(coroutine_handle<> handle) const = 0;
+  /** @brief Resumes the handle of a cancellable timer as soon as possible instead of at its deadline.
+   *         If the timer is not scheduled yet, it fires as soon as it is. Does nothing if it has fired already.
+   */
+  virtual void cancel_timer(timer_entry& entry) = 0;
 
   virtual ~abstract_engine(){}
 };
 
-struct sleep_awaiter: suspend_always {
+/** @brief Returns the cancellation token of the coroutine, or an empty one if its promise has none.
+ */
+template<typename P>
+cancellation_token token_of(coroutine_handle<P> handle) {
+  if constexpr(requires { handle.promise().token; }) {
+    return handle.promise().token;
+  } else {
+    return cancellation_token{};
+  }
+}
+
+/** @brief Returns the priority class of the coroutine, or normal if its promise has none.
+ */
+template<typename P>
+priority priority_of(coroutine_handle<P> handle) {
+  if constexpr(requires { handle.promise().prio; }) {
+    return handle.promise().prio.value_or(priority::normal);
+  } else {
+    return priority::normal;
+  }
+}
+
+/** @brief Suspends until a deadline.
+ *         If the awaiting coroutine has a cancellation token, the timer is removed from the engine on cancellation
+ *         and co_await throws operation_cancelled right away.
+ */
+struct sleep_awaiter {
   abstract_engine* engine_ptr;
-  msec awake_at;
+  timer_entry entry;
+  cancellation_token token;
+  cancellation_callback callback;
 
-  sleep_awaiter(abstract_engine* engine, msec awake_at):
-    engine_ptr(engine), awake_at(awake_at)
+  sleep_awaiter(abstract_engine* engine, time_point awake_at):
+    engine_ptr(engine), entry{.awake_at = awake_at}, token(), callback()
   {}
 
+  constexpr bool await_ready() const noexcept {
+    return false;
+  }
+
   template<typename T>
-  void await_suspend(coroutine_handle<T> caller) const {
+  bool await_suspend(coroutine_handle<T> caller) {
     if(!engine_ptr){
       throw no_engine{};
     }
-    engine_ptr->schedule(caller, awake_at);
+    token = token_of(caller);
+    entry.prio = priority_of(caller);
+    if(!token) {
+      engine_ptr->schedule(caller, entry.awake_at, entry.prio);
+      return true;
+    }
+    entry.handle = caller;
+    callback.fn = [](void* self) {
+      auto awaiter = static_cast<sleep_awaiter*>(self);
+      awaiter->engine_ptr->cancel_timer(awaiter->entry);
+    };
+    callback.context = this;
+    if(!token.register_callback(callback)) {
+      // Already cancelled
+      return false;
+    }
+    engine_ptr->schedule_timer(entry);
+    return true;
+  }
+
+  void await_resume() {
+    if(token) {
+      token.deregister_callback(callback);
+      token.throw_if_cancellation_requested();
+    }
   }
 };
 
-template<typename T>
-struct result_awaiter;
+/** @brief co_await current_cancellation_token{} gives the cancellation token of the calling task,
+ *         for cancellation checks in code that does not sleep.
+ */
+struct current_cancellation_token {
+  cancellation_token token;
 
-template<>
-struct result_awaiter<void> {
-  bool& done;
-  std::function<void(coroutine_handle<>)> call_after;
+  constexpr bool await_ready() const noexcept {
+    return false;
+  }
+
+  template<typename P>
+  bool await_suspend(coroutine_handle<P> caller) {
+    token = token_of(caller);
+    return false;
+  }
+
+  cancellation_token await_resume() {
+    return std::move(token);
+  }
+};
+
+/** @brief A coroutine waiting for a task to finish.
+ *         Nodes live in the awaiters, i.e. in the frames of the waiting coroutines,
+ *         and are linked into an intrusive list in the task_state.
+ */
+struct continuation {
+  coroutine_handle<> handle;
+  continuation* next;
+  // If set, called when the task finishes instead of resuming handle, e.g. to count down in when_all().
+  // It returns the coroutine to resume, or nullptr for none.
+  coroutine_handle<> (*notify)(continuation& node);
+};
+
+/** @brief Completion state of a task, shared between the task object and its frame.
+ *         It lives in the task object rather than the promise, so an awaiter on any thread can inspect it
+ *         after the frame has destroyed itself. finish() is the last access of the frame to it.
+ */
+struct task_state {
+  // Whether the task has been handed to an engine or started by an awaiter. A started task is
+  // resumed by the engine until it finishes, so it must never be scheduled a second time.
+  std::atomic<bool> started;
+  // nullptr, the list of awaiting continuations (most recent first), or finished_tag()
+  std::atomic<void*> awaiters;
+  // The exception the task finished with, rethrown to its awaiters. Written before finish().
+  std::exception_ptr error;
+
+  static void* finished_tag() noexcept {
+    static char tag;
+    return &tag;
+  }
+
+  task_state(bool started = false, bool done = false, std::exception_ptr error = nullptr):
+    started(started), awaiters(done ? finished_tag() : nullptr), error(std::move(error))
+  {}
+
+  bool is_done() const noexcept {
+    return awaiters.load(std::memory_order_acquire) == finished_tag();
+  }
+
+  /** @brief Whether continuations are registered, i.e. some coroutine is awaiting the unfinished task.
+   */
+  bool has_awaiters() const noexcept {
+    auto head = awaiters.load(std::memory_order_acquire);
+    return head != nullptr && head != finished_tag();
+  }
+
+  /** @brief Marks the task as started.
+   *  @return Whether the caller is the one who starts it.
+   */
+  bool try_start() noexcept {
+    return !started.exchange(true, std::memory_order_acq_rel);
+  }
+
+  /** @brief Registers a continuation.
+   *  @return false if the task has finished in the meantime and the continuation is not registered.
+   */
+  bool add_awaiter(continuation& node) noexcept {
+    void* old = awaiters.load(std::memory_order_acquire);
+    do {
+      if(old == finished_tag()) {
+        return false;
+      }
+      node.next = static_cast<continuation*>(old);
+    } while(!awaiters.compare_exchange_weak(old, &node, std::memory_order_acq_rel, std::memory_order_acquire));
+    return true;
+  }
+
+  /** @brief Marks the task as finished.
+   *  @return The registered continuations in the order they were added.
+   */
+  continuation* finish() noexcept {
+    auto node = static_cast<continuation*>(awaiters.exchange(finished_tag(), std::memory_order_acq_rel));
+    continuation* fifo = nullptr;
+    while(node) {
+      auto next = node->next;
+      node->next = fifo;
+      fifo = node;
+      node = next;
+    }
+    return fifo;
+  }
+};
+
+struct abstract_task {
+  virtual bool is_done() = 0;
+
+  /** @brief The completion state, through which the task can be awaited without knowing its result type.
+   */
+  virtual task_state& get_state() = 0;
+
+  virtual ~abstract_task(){}
+};
+
+struct base_task_promise: public pooled_frame {
+  abstract_engine* engine_ptr;
+  task_state* state;
+  std::exception_ptr error;
+  // Inherited from the first awaiter unless set_cancellation_token() is called
+  cancellation_token token;
+  // Inherited from the first awaiter unless set_priority() is called
+  std::optional<priority> prio;
   uint64_t promise_id;
-  abstract_engine*& engine_ptr;
 
-  result_awaiter(bool& done, std::function<void(coroutine_handle<>)> call_after, uint64_t promise_id,
-    abstract_engine*& engine):
-    done(done), call_after(call_after), promise_id(promise_id), engine_ptr(engine)
+  base_task_promise(abstract_engine* engine):
+    engine_ptr(engine), state(nullptr), error(), token(), prio(), promise_id(generate_id())
   {}
 
-  bool await_ready() const noexcept {
-    return done;
+  /** @brief Hands the task to its engine if it is not started yet.
+   */
+  void schedule_once(coroutine_handle<> self, time_point tim) {
+    if(state->try_start()) {
+      engine_ptr->schedule(self, tim, prio.value_or(priority::normal));
+    }
   }
 
-  /*constexpr*/ void await_resume() {
-    std::cout << "await_resume of " << promise_id;
-    if(!done) {
-      std::cout << " is not done!!!" << std::endl;
-    } else {
-      std::cout << " returned void" << std::endl;
+  /** @brief Registers an awaiter of the task self, starting it inline if nobody runs it yet.
+   *         The frame may be destroyed by another thread at any time after the task is started,
+   *         so the promise is only accessed by the one who starts it.
+   *  @return The handle to transfer to.
+   */
+  static coroutine_handle<> await_task(coroutine_handle<> self, base_task_promise& promise, task_state& state,
+                                       continuation& node, abstract_engine* caller_engine,
+                                       cancellation_token&& caller_token, priority caller_prio) {
+    if(state.try_start()) {
+      if(!promise.engine_ptr) {
+        promise.engine_ptr = caller_engine;
+      }
+      if(!promise.token) {
+        promise.token = std::move(caller_token);
+      }
+      if(!promise.prio) {
+        promise.prio = caller_prio;
+      }
+      if(!promise.engine_ptr) {
+        state.started.store(false, std::memory_order_relaxed);
+        throw no_engine{};
+      }
+      // Remark parent coroutine to resume it after the current one finishes
+      state.add_awaiter(node);
+      // Start the current one inline since no engine is running it
+      return self;
+    }
+    if(!state.add_awaiter(node)) {
+      // Finished in the meantime
+      return node.handle;
     }
+    return noop_coroutine();
   }
 
-  template<typename T2>
-  void await_suspend(coroutine_handle<T2> caller) {
-    if(!engine_ptr){
-      engine_ptr = caller.promise().engine_ptr;
+  auto initial_suspend() {
+    ASYNCIO_TRACE("initial_suspend of ", promise_id);
+    return suspend_always();
+  }
+
+  /** @brief Resumes the awaiters when the task finishes.
+   *         The first awaiter is resumed by symmetric transfer; the others are scheduled on the engine.
+   *         The frame is destroyed here, so the result must be stored outside the promise.
+   */
+  struct final_awaiter {
+    constexpr bool await_ready() const noexcept {
+      return false;
+    }
+
+    template<typename P>
+    coroutine_handle<> await_suspend(coroutine_handle<P> self) noexcept {
+      auto& promise = self.promise();
+      // The task object may be gone once finish() returns
+      auto node = promise.state->finish();
+      coroutine_handle<> next = nullptr;
+      while(node) {
+        // The node lives in the awaiter's frame, which may be gone once it is resumed or notified
+        auto following = node->next;
+        auto handle = node->notify ? node->notify(*node) : node->handle;
+        node = following;
+        if(!handle) {
+          continue;
+        }
+        if(!next) {
+          ASYNCIO_TRACE("final_suspend of ", promise.promise_id, " transfers to ", handle.address());
+          next = handle;
+          continue;
+        }
+        // Every awaiter is suspended on this task, and one task can only co_await on one thing,
+        // so none of them can be scheduled already.
+        if(!promise.engine_ptr){
+          // throw no_engine{};
+          std::cerr << no_engine{}.what() << std::endl;
+          std::terminate();
+        }
+        ASYNCIO_TRACE("final_suspend of ", promise.promise_id, " schedules ", handle.address());
+        promise.engine_ptr->schedule(handle, asap, promise.prio.value_or(priority::normal));
+      }
+      if(!next) {
+        next = noop_coroutine();
+      }
+      self.destroy();
+      return next;
+    }
+
+    constexpr void await_resume() const noexcept {}
+  };
+
+  final_awaiter final_suspend() noexcept {
+    ASYNCIO_TRACE("final_suspend of ", promise_id);
+    return final_awaiter{};
+  }
+
+  /** @brief Passes the exception to the awaiters of the task, which rethrow it from co_await.
+   *         A task nobody awaits rethrows it from the engine as before, unless it is a cancellation.
+   */
+  void unhandled_exception() {
+    error = std::current_exception();
+    ASYNCIO_TRACE("catched unhandled exception");
+    state->error = error;
+    if(state->awaiters.load(std::memory_order_acquire) != nullptr) {
+      return;
+    }
+    try {
+      std::rethrow_exception(error);
+    } catch(const operation_cancelled&) {
+      ASYNCIO_TRACE("task ", promise_id, " is cancelled");
     }
-    call_after(caller);
   }
 };
 
 template<typename T>
-struct result_awaiter {
-  std::optional<T>& result;
-  std::function<void(coroutine_handle<>)> call_after;
+struct result_awaiter;
+
+template<>
+struct result_awaiter<void> {
+  task_state& state;
+  // The awaited task. Its promise is only accessed if the awaiter is the one who starts it.
+  coroutine_handle<> task_handle;
+  base_task_promise* promise;
   uint64_t promise_id;
-  abstract_engine*& engine_ptr;
+  continuation node;
 
-  result_awaiter(std::optional<T>& result, std::function<void(coroutine_handle<>)> call_after, uint64_t promise_id,
-    abstract_engine*& engine):
-    result(result), call_after(call_after), promise_id(promise_id), engine_ptr(engine)
+  result_awaiter(task_state& state, coroutine_handle<> task_handle, base_task_promise* promise, uint64_t promise_id):
+    state(state), task_handle(task_handle), promise(promise), promise_id(promise_id), node()
   {}
 
   bool await_ready() const noexcept {
-    return result.has_value();
+    return state.is_done();
   }
 
-  /*constexpr*/ T await_resume() {
-    std::cout << "await_resume of " << promise_id;
-    if(!result.has_value()) {
-      std::cout << " returned no value, error" << std::endl;
-      throw no_value_returned{};
+  /*constexpr*/ void await_resume() {
+    if(state.error) {
+      std::rethrow_exception(state.error);
+    }
+    if(!state.is_done()) {
+      ASYNCIO_TRACE("await_resume of ", promise_id, " is not done!!!");
+    } else {
+      ASYNCIO_TRACE("await_resume of ", promise_id, " returned void");
     }
-    std::cout << " returned " << result.value() << std::endl;
-    return std::move(result.value());
   }
 
+  /** @brief Registers the caller as a continuation. Nothing is allocated: the node lives in the awaiter.
+   *  @return The handle to transfer to: the awaited task if it should start inline,
+   *          or noop_coroutine() to return to the engine.
+   */
   template<typename T2>
-  void await_suspend(coroutine_handle<T2> caller) {
-    if(!engine_ptr){
-      engine_ptr = caller.promise().engine_ptr;
-    }
-    call_after(caller);
+  coroutine_handle<> await_suspend(coroutine_handle<T2> caller) {
+    node.handle = caller;
+    return base_task_promise::await_task(task_handle, *promise, state, node, caller.promise().engine_ptr,
+                                         token_of(caller), priority_of(caller));
   }
 };
 
-struct base_task_promise {
-  abstract_engine* engine_ptr;
-  std::list<coroutine_handle<>> on_finish;
-  std::exception_ptr error;
+template<typename T>
+struct result_awaiter {
+  task_state& state;
+  std::optional<T>& result;
+  // The awaited task. Its promise is only accessed if the awaiter is the one who starts it.
+  coroutine_handle<> task_handle;
+  base_task_promise* promise;
   uint64_t promise_id;
+  continuation node;
 
-  base_task_promise(abstract_engine* engine):
-    engine_ptr(engine), on_finish(), error(), promise_id(generate_id())
+  result_awaiter(task_state& state, std::optional<T>& result, coroutine_handle<> task_handle,
+    base_task_promise* promise, uint64_t promise_id):
+    state(state), result(result), task_handle(task_handle), promise(promise), promise_id(promise_id), node()
   {}
 
-  auto initial_suspend() {
-    std::cout << "initial_suspend of " << promise_id << std::endl;
-    return suspend_always();
+  bool await_ready() const noexcept {
+    return state.is_done();
   }
 
-  auto final_suspend() noexcept {
-    std::cout << "final_suspend of " << promise_id << std::endl;
-    if(!engine_ptr){
-      // throw no_engine{};
-      std::cerr << no_engine{}.what() << std::endl;
-      std::terminate();
+  /*constexpr*/ T await_resume() {
+    if(state.error) {
+      std::rethrow_exception(state.error);
     }
-    for(auto& h: on_finish){
-      std::cout << "call_after of " << promise_id << " try to schedule " << h.address() << " ... ";
-      if(!engine_ptr->is_scheduled(h)) {
-        std::cout << "done" << std::endl;
-        engine_ptr->schedule(h, 0);
-      } else {
-        std::cout << "skipped" << std::endl;
-        // IMPOSSIBLE because one task can only co_await on one thing
-      }
+    if(!result.has_value()) {
+      ASYNCIO_TRACE("await_resume of ", promise_id, " returned no value, error");
+      throw no_value_returned{};
     }
-    return suspend_never();
+    ASYNCIO_TRACE("await_resume of ", promise_id, " returned ", result.value());
+    return std::move(result.value());
   }
 
-  void unhandled_exception() {
-    error = std::current_exception();
-    // Probably shoudln't rethrow in real world; should let the user handle it.
-    std::cout << "catched unhandled exception" << std::endl;
-    std::rethrow_exception(error);
+  /** @brief Registers the caller as a continuation. Nothing is allocated: the node lives in the awaiter.
+   *  @return The handle to transfer to: the awaited task if it should start inline,
+   *          or noop_coroutine() to return to the engine.
+   */
+  template<typename T2>
+  coroutine_handle<> await_suspend(coroutine_handle<T2> caller) {
+    node.handle = caller;
+    return base_task_promise::await_task(task_handle, *promise, state, node, caller.promise().engine_ptr,
+                                         token_of(caller), priority_of(caller));
   }
 };
 
@@ -160,15 +452,14 @@ struct task;
 
 template<>
 struct task<void>: public abstract_task {
+  using value_type = void;
   using awaiter = result_awaiter<void>;
 
   struct promise_type: public base_task_promise {
-    // NOTE: Promise is destryoed because final_suspend() returns suspend_never, so it cannot hold any result value!
-    bool* done;
+    // NOTE: Promise is destroyed by final_suspend(), so it cannot hold any result value!
 
     void return_void() {
-      std::cout << "return_value of " << promise_id << " returned void" << std::endl;
-      *done = true;
+      ASYNCIO_TRACE("return_value of ", promise_id, " returned void");
     }
 
     task get_return_object() {
@@ -187,40 +478,63 @@ struct task<void>: public abstract_task {
     handle.promise().engine_ptr = &engine;
   }
 
+  /** @brief Lets the task and the tasks it awaits be cancelled through token.
+   *  @pre The task is not started.
+   */
+  void set_cancellation_token(cancellation_token token) {
+    handle.promise().token = std::move(token);
+  }
+
+  /** @brief Sets the priority class of the task and of the tasks it awaits.
+   *  @pre The task is not started.
+   */
+  void set_priority(priority prio) {
+    handle.promise().prio = prio;
+  }
+
   awaiter operator co_await(){
-    const auto& handle = this->handle;
-    auto& promise = handle.promise();
-    return awaiter(done,
-      [handle, &promise](coroutine_handle<> event){
-        if(!promise.engine_ptr) {
-          throw no_engine{};
-        }
-        // Schedule the current one if it is not
-        if(!promise.engine_ptr->is_scheduled(handle)) {
-          promise.engine_ptr->schedule(handle, 0);
-        }
-        // Remark parent coroutine to schedule it after the current one finishes
-        promise.on_finish.push_back(event);
-      }, promise.promise_id, promise.engine_ptr);
+    // The frame is destroyed once the task is done, so the promise is only accessed in await_suspend.
+    return awaiter(state, handle, &handle.promise(), promise_id);
   }
 
   bool is_done() {
-    return done;
+    return state.is_done();
+  }
+
+  task_state& get_state() {
+    return state;
+  }
+
+  /** @brief Rethrows the exception the task finished with, if any.
+   */
+  void result() {
+    if(state.error) {
+      std::rethrow_exception(state.error);
+    }
   }
 
   task(coroutine_handle<promise_type> handle):
-    handle(handle), done(false)
+    handle(handle), promise_id(handle.promise().promise_id), state()
   {
-    std::cout << "task created: id=" << handle.promise().promise_id << " addr=" << handle.address() << std::endl;
-    handle.promise().done = &done;
+    ASYNCIO_TRACE("task created: id=", handle.promise().promise_id, " addr=", handle.address());
+    handle.promise().state = &state;
   }
 
   task(const task&) = delete;
   void operator=(const task&) = delete;
 
-  task(task&& rhs) {
-    handle = rhs.handle;
-    handle.promise().done = &done;
+  /** @brief Moves a task.
+   *  @pre The task is not running on another thread, and no coroutine is awaiting it:
+   *       the awaiters keep pointing to the state and the result of the old object.
+   */
+  task(task&& rhs):
+    handle(rhs.handle), promise_id(rhs.promise_id),
+    state(rhs.state.started.load(std::memory_order_relaxed), rhs.state.is_done(), rhs.state.error)
+  {
+    assert(!rhs.state.has_awaiters());
+    if(!state.is_done()) {
+      handle.promise().state = &state;
+    }
   }
 
   ~task() noexcept {
@@ -228,21 +542,23 @@ struct task<void>: public abstract_task {
   }
 
   coroutine_handle<promise_type> handle;
-  bool done;
+  uint64_t promise_id;
+  task_state state;
 };
 
 template<typename T>
 struct task: public abstract_task {
+  using value_type = T;
   using awaiter = result_awaiter<T>;
 
   struct promise_type: public base_task_promise {
-    // NOTE: Promise is destryoed because final_suspend() returns suspend_never, so it cannot hold any result value!
+    // NOTE: Promise is destroyed by final_suspend(), so it cannot hold any result value!
     std::optional<T> *result_ptr;
 
     template<CONVERTIBLE_TO(T) From>
     void return_value(From&& value) {
-      std::cout << "return_value of " << promise_id << " returned " << value << std::endl;
-      *result_ptr = std::forward<From>(value);
+      ASYNCIO_TRACE("return_value of ", promise_id, " returned ", value);
+      result_ptr->emplace(std::forward<From>(value));
     }
 
     task get_return_object() {
@@ -261,44 +577,65 @@ struct task: public abstract_task {
     handle.promise().engine_ptr = &engine;
   }
 
+  /** @brief Lets the task and the tasks it awaits be cancelled through token.
+   *  @pre The task is not started.
+   */
+  void set_cancellation_token(cancellation_token token) {
+    handle.promise().token = std::move(token);
+  }
+
+  /** @brief Sets the priority class of the task and of the tasks it awaits.
+   *  @pre The task is not started.
+   */
+  void set_priority(priority prio) {
+    handle.promise().prio = prio;
+  }
+
   awaiter operator co_await(){
-    const auto& handle = this->handle;
-    auto& promise = handle.promise();
-    return awaiter(result_val,
-      [handle, &promise](coroutine_handle<> event){
-        if(!promise.engine_ptr) {
-          throw no_engine{};
-        }
-        // Schedule the current one if it is not
-        if(!promise.engine_ptr->is_scheduled(handle)) {
-          promise.engine_ptr->schedule(handle, 0);
-        }
-        // Remark parent coroutine to schedule it after the current one finishes
-        promise.on_finish.push_back(event);
-      }, promise.promise_id, promise.engine_ptr);
+    // The frame is destroyed once the task is done, so the promise is only accessed in await_suspend.
+    return awaiter(state, result_val, handle, &handle.promise(), promise_id);
   }
 
   bool is_done() {
-    return result_val.has_value();
+    return state.is_done();
+  }
+
+  task_state& get_state() {
+    return state;
   }
 
   T result() {
+    if(state.error) {
+      std::rethrow_exception(state.error);
+    }
     return std::move(result_val.value());
   }
 
   task(coroutine_handle<promise_type> handle):
-    handle(handle), result_val(std::nullopt)
+    handle(handle), promise_id(handle.promise().promise_id), state(), result_val(std::nullopt)
   {
-    std::cout << "task created: id=" << handle.promise().promise_id << " addr=" << handle.address() << std::endl;
+    ASYNCIO_TRACE("task created: id=", handle.promise().promise_id, " addr=", handle.address());
+    handle.promise().state = &state;
     handle.promise().result_ptr = &result_val;
   }
 
   task(const task&) = delete;
   void operator=(const task&) = delete;
 
-  task(task&& rhs) {
-    handle = rhs.handle;
-    handle.promise().result_ptr = &result_val;
+  /** @brief Moves a task.
+   *  @pre The task is not running on another thread, and no coroutine is awaiting it:
+   *       the awaiters keep pointing to the state and the result of the old object.
+   */
+  task(task&& rhs):
+    handle(rhs.handle), promise_id(rhs.promise_id),
+    state(rhs.state.started.load(std::memory_order_relaxed), rhs.state.is_done(), rhs.state.error),
+    result_val(std::move(rhs.result_val))
+  {
+    assert(!rhs.state.has_awaiters());
+    if(!state.is_done()) {
+      handle.promise().state = &state;
+      handle.promise().result_ptr = &result_val;
+    }
   }
 
   ~task() noexcept {
@@ -306,6 +643,8 @@ struct task: public abstract_task {
   }
 
   coroutine_handle<promise_type> handle;
+  uint64_t promise_id;
+  task_state state;
   std::optional<T> result_val;
 };
 
@@ -0,0 +1,281 @@
+#pragma once
+
+#include "common.hpp"
+#include "utils.hpp"
+#include "sleep_engine.hpp"
+#include <array>
+#include <cerrno>
+#include <system_error>
+#include <unordered_map>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/timerfd.h>
+#include <unistd.h>
+
+namespace asyncio {
+
+struct epoll_engine;
+
+/** @brief Suspends the caller until a file descriptor is ready.
+ *         Returned by epoll_engine::readable() and epoll_engine::writable().
+ */
+struct fd_awaiter {
+  epoll_engine* engine_ptr;
+  int fd;
+  uint32_t event;
+
+  constexpr bool await_ready() const noexcept {
+    return false;
+  }
+
+  void await_suspend(coroutine_handle<> caller) const;
+
+  constexpr void await_resume() const noexcept {}
+};
+
+/** @brief A sleep_engine whose wait step is epoll_wait() with the next timer deadline as its timeout,
+ *         so a single thread can multiplex many sockets without polling.
+ *         Handles posted from other threads wake it up through an eventfd.
+ *         Timer deadlines are armed on a timerfd as absolute CLOCK_MONOTONIC times, so wakeups are not
+ *         rounded to the millisecond timeout of epoll_wait().
+ *         Readiness is level-triggered: a woken coroutine should read or write until EAGAIN,
+ *         or simply await again.
+ *         Linux only.
+ */
+struct epoll_engine: public sleep_engine {
+  /** @brief The coroutines waiting on one file descriptor.
+   */
+  struct fd_watch {
+    coroutine_handle<> reader;
+    coroutine_handle<> writer;
+
+    uint32_t interest() const noexcept {
+      return (reader ? EPOLLIN : 0u) | (writer ? EPOLLOUT : 0u);
+    }
+  };
+
+  static constexpr int max_events = 256;
+
+  int epoll_fd;
+  // Written by notify() to interrupt epoll_wait() when a handle is posted from another thread
+  int event_fd;
+  // Armed with the next timer deadline
+  int timer_fd;
+  time_point armed_deadline;
+  std::unordered_map<int, fd_watch> watches;
+  size_t waiting;  // Number of coroutines waiting on some fd
+
+  epoll_engine():
+    sleep_engine(), epoll_fd(::epoll_create1(EPOLL_CLOEXEC)), event_fd(-1), timer_fd(-1), armed_deadline(forever),
+    watches(), waiting(0)
+  {
+    if(epoll_fd < 0) {
+      throw std::system_error(errno, std::system_category(), "epoll_create1");
+    }
+    try {
+      event_fd = add_internal_fd(::eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK), "eventfd");
+      timer_fd = add_internal_fd(::timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC | TFD_NONBLOCK), "timerfd_create");
+    } catch(...) {
+      close_all();
+      throw;
+    }
+  }
+
+  epoll_engine(const epoll_engine&) = delete;
+  void operator=(const epoll_engine&) = delete;
+
+  ~epoll_engine() override {
+    close_all();
+  }
+
+  /** @brief co_await engine.readable(fd) resumes the caller once fd is readable, closed or in error.
+   */
+  fd_awaiter readable(int fd) {
+    return fd_awaiter{this, fd, EPOLLIN};
+  }
+
+  /** @brief co_await engine.writable(fd) resumes the caller once fd is writable, closed or in error.
+   */
+  fd_awaiter writable(int fd) {
+    return fd_awaiter{this, fd, EPOLLOUT};
+  }
+
+  /** @brief Registers caller to be scheduled when fd becomes ready for event.
+   *         At most one reader and one writer may wait on a file descriptor at a time.
+   */
+  void watch(int fd, uint32_t event, coroutine_handle<> caller) {
+    auto [it, inserted] = watches.try_emplace(fd);
+    auto& w = it->second;
+    auto& slot = (event == EPOLLIN) ? w.reader : w.writer;
+    if(slot) {
+      throw double_await{};
+    }
+    auto old_interest = w.interest();
+    try {
+      update(fd, old_interest, old_interest | event);
+    } catch(...) {
+      if(inserted) {
+        watches.erase(it);
+      }
+      throw;
+    }
+    slot = caller;
+    waiting ++;
+  }
+
+  /** @brief Stops watching fd. Must be called before closing a file descriptor that may have waiters;
+   *         the waiters are scheduled so that they can observe the closure.
+   */
+  void forget(int fd) {
+    auto it = watches.find(fd);
+    if(it == watches.end()) {
+      return;
+    }
+    auto w = it->second;
+    update(fd, w.interest(), 0);
+    watches.erase(it);
+    wake(w.reader);
+    wake(w.writer);
+  }
+
+  bool has_pending() const override {
+    return sleep_engine::has_pending() || waiting > 0;
+  }
+
+  void notify() override {
+    if(parked.exchange(false, std::memory_order_seq_cst)) {
+      uint64_t one = 1;
+      [[maybe_unused]] auto ret = ::write(event_fd, &one, sizeof(one));
+    }
+  }
+
+  void wait(time_point deadline) override {
+    std::array<epoll_event, max_events> events_out;
+    int timeout_ms = -1;
+    if(deadline <= tmer.now()) {
+      timeout_ms = 0;
+    } else {
+      arm(deadline);
+    }
+    // Either we see the posted handle, or the poster sees parked (both sides are seq_cst)
+    parked.store(true, std::memory_order_seq_cst);
+    if(!posted.empty()) {
+      timeout_ms = 0;
+    }
+    int n = ::epoll_wait(epoll_fd, events_out.data(), max_events, timeout_ms);
+    // A late notify() only leaves the eventfd readable, which causes one spurious wakeup
+    parked.store(false, std::memory_order_relaxed);
+    if(n < 0) {
+      if(errno == EINTR) {
+        return;
+      }
+      throw std::system_error(errno, std::system_category(), "epoll_wait");
+    }
+    for(int i = 0; i < n; i ++) {
+      int fd = events_out[i].data.fd;
+      if(fd == event_fd || fd == timer_fd) {
+        uint64_t count;
+        [[maybe_unused]] auto ret = ::read(fd, &count, sizeof(count));
+        if(fd == timer_fd) {
+          armed_deadline = forever;
+        }
+        continue;
+      }
+      auto it = watches.find(fd);
+      if(it == watches.end()) {
+        continue;
+      }
+      auto& w = it->second;
+      auto old_interest = w.interest();
+      // Errors and hang-ups wake both sides
+      uint32_t got = events_out[i].events;
+      bool err = got & (EPOLLERR | EPOLLHUP);
+      coroutine_handle<> reader, writer;
+      if(w.reader && (err || (got & EPOLLIN))) {
+        std::swap(reader, w.reader);
+      }
+      if(w.writer && (err || (got & EPOLLOUT))) {
+        std::swap(writer, w.writer);
+      }
+      update(fd, old_interest, w.interest());
+      if(w.interest() == 0) {
+        watches.erase(it);
+      }
+      wake(reader);
+      wake(writer);
+    }
+  }
+
+private:
+  int add_internal_fd(int fd, const char* what) {
+    if(fd < 0) {
+      throw std::system_error(errno, std::system_category(), what);
+    }
+    epoll_event ev{};
+    ev.events = EPOLLIN;
+    ev.data.fd = fd;
+    if(::epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &ev) < 0) {
+      auto err = errno;
+      ::close(fd);
+      throw std::system_error(err, std::system_category(), "epoll_ctl");
+    }
+    return fd;
+  }
+
+  void close_all() noexcept {
+    for(int fd: {timer_fd, event_fd, epoll_fd}) {
+      if(fd >= 0) {
+        ::close(fd);
+      }
+    }
+  }
+
+  /** @brief Arms the timerfd at an absolute deadline, unless it is already armed at it.
+   *         A stale expiration only causes one spurious wakeup.
+   */
+  void arm(time_point deadline) {
+    if(deadline == armed_deadline) {
+      return;
+    }
+    itimerspec spec{};
+    if(deadline != forever) {
+      auto ns = deadline.time_since_epoch().count();
+      spec.it_value.tv_sec = static_cast<time_t>(ns / 1000000000);
+      spec.it_value.tv_nsec = static_cast<long>(ns % 1000000000);
+    }
+    if(::timerfd_settime(timer_fd, TFD_TIMER_ABSTIME, &spec, nullptr) < 0) {
+      throw std::system_error(errno, std::system_category(), "timerfd_settime");
+    }
+    armed_deadline = deadline;
+  }
+
+  void update(int fd, uint32_t old_interest, uint32_t new_interest) {
+    if(old_interest == new_interest) {
+      return;
+    }
+    epoll_event ev{};
+    ev.events = new_interest;
+    ev.data.fd = fd;
+    int op = !old_interest ? EPOLL_CTL_ADD : (!new_interest ? EPOLL_CTL_DEL : EPOLL_CTL_MOD);
+    if(::epoll_ctl(epoll_fd, op, fd, &ev) < 0) {
+      // The fd may have been closed already; nothing is left to unregister then
+      if(op == EPOLL_CTL_DEL && (errno == EBADF || errno == ENOENT)) {
+        return;
+      }
+      throw std::system_error(errno, std::system_category(), "epoll_ctl");
+    }
+  }
+
+  void wake(coroutine_handle<> handle) {
+    if(handle) {
+      waiting --;
+      schedule(handle, asap);
+    }
+  }
+};
+
+inline void fd_awaiter::await_suspend(coroutine_handle<> caller) const {
+  engine_ptr->watch(fd, event, caller);
+}
+
+} // namespace asyncio
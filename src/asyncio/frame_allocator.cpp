@@ -0,0 +1,27 @@
+#include "frame_allocator.hpp"
+
+namespace asyncio {
+
+namespace {
+
+// Trivially destructible, so it can still be read after the pool of the thread is destroyed
+thread_local bool local_pool_destroyed = false;
+
+struct local_frame_pool: public frame_pool {
+  ~local_frame_pool() override {
+    local_pool_destroyed = true;
+  }
+};
+
+} // namespace
+
+frame_pool& frame_pool::local() noexcept {
+  thread_local local_frame_pool pool;
+  return pool;
+}
+
+frame_pool* frame_pool::local_if_alive() noexcept {
+  return local_pool_destroyed ? nullptr : &local();
+}
+
+} // namespace asyncio
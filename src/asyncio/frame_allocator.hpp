@@ -0,0 +1,172 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <new>
+
+namespace asyncio {
+
+/** @brief Interface of an allocator for coroutine frames.
+ *         Pass one to a coroutine with the allocator-argument convention:
+ *         @code
+ *         task<int> f(std::allocator_arg_t, frame_allocator& alloc, int x);
+ *         co_await f(std::allocator_arg, my_pool, 1);
+ *         @endcode
+ *         The allocator must outlive every frame allocated from it.
+ */
+struct frame_allocator {
+  virtual ~frame_allocator() {}
+
+  virtual void* allocate(std::size_t size) = 0;
+
+  virtual void deallocate(void* ptr, std::size_t size) noexcept = 0;
+};
+
+/** @brief Counters of a frame_pool.
+ */
+struct frame_stats {
+  uint64_t allocations = 0;
+  uint64_t deallocations = 0;
+  /// Allocations served from a free list, i.e. recycled frames.
+  uint64_t reused = 0;
+  /// Allocations that went to the global operator new.
+  uint64_t system_allocations = 0;
+};
+
+/** @brief A size-class free-list pool of coroutine frames.
+ *         Frames are rounded up to a multiple of granularity; freed blocks are kept for reuse.
+ *         Not thread-safe. The default pool is per thread, see frame_pool::local().
+ */
+struct frame_pool: public frame_allocator {
+  static constexpr std::size_t granularity = 64;
+  static constexpr std::size_t class_count = 32;  // Frames up to 2 KiB are pooled
+  static constexpr std::size_t max_cached = 4096;  // Per size class
+
+  struct free_block {
+    free_block* next;
+  };
+
+  std::array<free_block*, class_count> free_lists;
+  std::array<std::size_t, class_count> cached;
+  frame_stats stats;
+
+  frame_pool():
+    free_lists(), cached(), stats()
+  {}
+
+  frame_pool(const frame_pool&) = delete;
+  void operator=(const frame_pool&) = delete;
+
+  ~frame_pool() override {
+    release();
+  }
+
+  static constexpr std::size_t size_class(std::size_t size) noexcept {
+    return (size + granularity - 1) / granularity - 1;
+  }
+
+  void* allocate(std::size_t size) override {
+    ++ stats.allocations;
+    auto cls = size_class(size);
+    if(cls < class_count) {
+      if(auto block = free_lists[cls]) {
+        free_lists[cls] = block->next;
+        -- cached[cls];
+        ++ stats.reused;
+        return block;
+      }
+      ++ stats.system_allocations;
+      return ::operator new((cls + 1) * granularity);
+    }
+    ++ stats.system_allocations;
+    return ::operator new(size);
+  }
+
+  void deallocate(void* ptr, std::size_t size) noexcept override {
+    ++ stats.deallocations;
+    auto cls = size_class(size);
+    if(cls < class_count && cached[cls] < max_cached) {
+      auto block = static_cast<free_block*>(ptr);
+      block->next = free_lists[cls];
+      free_lists[cls] = block;
+      ++ cached[cls];
+      return;
+    }
+    ::operator delete(ptr);
+  }
+
+  /** @brief Returns all cached blocks to the global allocator.
+   */
+  void release() noexcept {
+    for(std::size_t cls = 0; cls < class_count; cls ++) {
+      while(auto block = free_lists[cls]) {
+        free_lists[cls] = block->next;
+        ::operator delete(block);
+      }
+      cached[cls] = 0;
+    }
+  }
+
+  /** @brief The pool of the calling thread, used by coroutines without an allocator argument.
+   */
+  static frame_pool& local() noexcept;
+
+  /** @brief local(), or nullptr once the pool has been destroyed at thread exit,
+   *         e.g. when a frame owned by a global object is freed during static destruction.
+   */
+  static frame_pool* local_if_alive() noexcept;
+};
+
+/** @brief Base of promise types that allocate their frames from a frame_allocator.
+ *         A header in front of the frame records the allocator, or nullptr for the thread-local pool.
+ *         A frame freed on another thread goes to that thread's pool. Once the pool of a thread is destroyed,
+ *         frames go directly to the global allocator; the pool gets its blocks from there as well.
+ */
+struct pooled_frame {
+  static constexpr std::size_t header_size = alignof(std::max_align_t);
+
+  static void* allocate_frame(std::size_t size, frame_allocator* alloc) {
+    void* block;
+    if(alloc) {
+      block = alloc->allocate(size + header_size);
+    } else if(auto pool = frame_pool::local_if_alive()) {
+      block = pool->allocate(size + header_size);
+    } else {
+      block = ::operator new(size + header_size);
+    }
+    *static_cast<frame_allocator**>(block) = alloc;
+    return static_cast<std::byte*>(block) + header_size;
+  }
+
+  static void* operator new(std::size_t size) {
+    return allocate_frame(size, nullptr);
+  }
+
+  template<typename... Args>
+  static void* operator new(std::size_t size, std::allocator_arg_t, frame_allocator& alloc, Args&...) {
+    return allocate_frame(size, &alloc);
+  }
+
+  /** @brief Member function coroutines receive the object as the first argument.
+   */
+  template<typename Object, typename... Args>
+  static void* operator new(std::size_t size, Object&, std::allocator_arg_t, frame_allocator& alloc, Args&...) {
+    return allocate_frame(size, &alloc);
+  }
+
+  static void operator delete(void* ptr, std::size_t size) noexcept {
+    auto block = static_cast<std::byte*>(ptr) - header_size;
+    auto alloc = *reinterpret_cast<frame_allocator**>(block);
+    if(alloc) {
+      alloc->deallocate(block, size + header_size);
+    } else if(auto pool = frame_pool::local_if_alive()) {
+      pool->deallocate(block, size + header_size);
+    } else {
+      ::operator delete(block);
+    }
+  }
+};
+
+} // namespace asyncio
@@ -3,13 +3,21 @@
 #include <optional>
 #include <exception>
 #include <memory>
-#include <iostream>
+#include <utility>
+#include <algorithm>
+#include <cstddef>
+#include <iterator>
+#include <ranges>
+#include <span>
 #include "common.hpp"
 #include "utils.hpp"
+#include "trace.hpp"
+#include "frame_allocator.hpp"
 
 namespace asyncio {
 
-/** @brief Common interface of yield-based coroutine and generator.
+/** @brief Type-erased interface of yield-based coroutine and generator.
+ *         Generators do not derive from it; wrap one in a fiber<Generator> where a virtual interface is needed.
  */
 template<typename YieldType>
 struct abstract_fiber {
@@ -27,23 +35,59 @@ struct abstract_fiber {
   virtual std::optional<YieldType> next() = 0;
 };
 
+/** @brief Yields every element of a contiguous range with one suspension: co_yield elements_of(buffer).
+ *         The elements must stay alive until the generator is resumed; the co_yield expression has no value.
+ */
+template<typename T>
+struct elements_of {
+  std::span<T> elements;
+
+  explicit elements_of(std::span<T> elements):
+    elements(elements)
+  {}
+
+  template<std::ranges::contiguous_range Range>
+  explicit elements_of(Range&& range):
+    elements(std::ranges::data(range), std::ranges::size(range))
+  {}
+};
+
+template<std::ranges::contiguous_range Range>
+elements_of(Range&&) -> elements_of<std::remove_reference_t<std::ranges::range_reference_t<Range>>>;
+
 /** @brief A promise that can be chained with another.
+ *         It drives its own coroutine, so stepping a generator needs no virtual call.
+ *         When a generator co_await another one, the awaiting chain is linked by parent pointers,
+ *         and the root remembers the innermost running one (the leaf). next() resumes the leaf directly
+ *         and values are yielded straight into the root, so each step costs O(1) at any nesting depth.
+ *         A yielded value is not copied: the root points to it, and it stays valid until the next resume.
  */
 template<typename YieldType, typename SendAwaitable = suspend_always>
-struct chainable_promise {
-  abstract_fiber<YieldType>* nested;
+struct chainable_promise: public pooled_frame {
+  coroutine_handle<> self;
+  // Promises of the same yield and send types can chain regardless of their return types
+  chainable_promise* parent;
+  chainable_promise* root;
+  // Only meaningful on the root
+  chainable_promise* leaf;
   std::exception_ptr error;
-  std::optional<YieldType> yielded_value;
+  // Points to the value being yielded, which lives in the suspended frame
+  YieldType* yielded_ptr;
+  // Holds yielded values that have to be converted or copied, i.e. those of other types or const
+  std::optional<YieldType> yielded_storage;
+  // Rest of the chunk being yielded by elements_of, which is consumed without resuming
+  YieldType* chunk_next;
+  YieldType* chunk_end;
   bool done;
-  bool no_yield_finish;
   SendAwaitable sender;
   uint64_t promise_id;
 
-  constexpr chainable_promise():
-    nested(nullptr), error(), yielded_value(std::nullopt), done(false), no_yield_finish(false),
+  chainable_promise():
+    self(), parent(nullptr), root(this), leaf(this), error(), yielded_ptr(nullptr),
+    yielded_storage(std::nullopt), chunk_next(nullptr), chunk_end(nullptr), done(false),
     sender(), promise_id(generate_id())
   {
-    std::cout << "Generator (" << this->promise_id << ") created" << std::endl;
+    ASYNCIO_TRACE("Generator (", this->promise_id, ") created");
   }
 
   /** @brief Called when a new coroutine is created
@@ -53,46 +97,155 @@ struct chainable_promise {
     return suspend_always();
   }
 
+  /** @brief Suspends to retain the result, and hands the control back to the awaiting generator if any.
+   */
+  struct final_awaiter {
+    constexpr bool await_ready() const noexcept {
+      return false;
+    }
+
+    template<typename P>
+    coroutine_handle<> await_suspend(coroutine_handle<P> self) noexcept {
+      chainable_promise& promise = self.promise();
+      if(!promise.parent) {
+        return noop_coroutine();
+      }
+      ASYNCIO_TRACE("Generator (", promise.promise_id, ") returns to (", promise.parent->promise_id, ")");
+      promise.root->leaf = promise.parent;
+      return promise.parent->self;
+    }
+
+    constexpr void await_resume() const noexcept {}
+  };
+
   /** @brief Called when a coroutine finishes and before the self-destruction of promise.
-   *         Here we suspends to retain the result.
    */
-  constexpr auto final_suspend() noexcept {
-    std::cout << "Generator (" << promise_id << ") final_suspend" << std::endl;
-    return suspend_always();
+  final_awaiter final_suspend() noexcept {
+    ASYNCIO_TRACE("Generator (", promise_id, ") final_suspend");
+    return final_awaiter{};
   }
 
   void unhandled_exception() {
     error = std::current_exception();
   }
 
-  void chain(abstract_fiber<YieldType>* inner_fiber) {
-    if(nested && !nested->is_done()){
+  /** @brief Links this generator under an awaiting one.
+   *         A generator that has been partly consumed may be suspended in its own yield-from, or in a chunk:
+   *         its whole chain is moved under the new root, which continues from where it stopped.
+   *  @return The handle to transfer to, i.e. the innermost generator of this chain,
+   *          or noop_coroutine() if the rest of a chunk is yielded first.
+   */
+  coroutine_handle<> chain(chainable_promise& outer) {
+    if(parent) {
       throw double_await();
     }
-    nested = inner_fiber;
+    parent = &outer;
+    auto new_root = outer.root;
+    for(auto promise = leaf; promise != this; promise = promise->parent) {
+      promise->root = new_root;
+    }
+    root = new_root;
+    new_root->leaf = leaf;
+    if(chunk_next != chunk_end) {
+      new_root->yielded_ptr = chunk_next ++;
+      new_root->chunk_next = std::exchange(chunk_next, nullptr);
+      new_root->chunk_end = std::exchange(chunk_end, nullptr);
+      return noop_coroutine();
+    }
+    return leaf->self;
   }
 
-  std::optional<YieldType> wait_nested(){
-    if(!nested) {
-      return std::nullopt;
+  /** @brief Continues the execution until the next yielded value.
+   *  @pre This is the root of its chain.
+   *  @return The yielded value, valid until the next resume, or nullptr if the coroutine co_return.
+   */
+  YieldType* next_ref() {
+    if(chunk_next != chunk_end) {
+      return yielded_ptr = chunk_next ++;
     }
-    if(nested->is_done()){
-      nested = nullptr;
-      return std::nullopt;
+    if(done) {
+      return nullptr;
+    }
+    ASYNCIO_TRACE("Generator (", promise_id, ") resumes (", leaf->promise_id, ") in next()");
+    leaf->self.resume();
+    if(error){
+      std::rethrow_exception(error);
+    } else if(done){
+      return nullptr;
+    }
+    return yielded_ptr;
+  }
+
+  /** @brief Fills out with the next values, copying chunks as a whole.
+   *  @pre This is the root of its chain.
+   *  @return The number of values written, which is less than out.size() only if the coroutine co_return.
+   */
+  size_t next_batch(std::span<YieldType> out) {
+    size_t count = 0;
+    while(count < out.size()) {
+      if(chunk_next != chunk_end) {
+        auto n = std::min(static_cast<size_t>(chunk_end - chunk_next), out.size() - count);
+        std::copy_n(chunk_next, n, out.begin() + count);
+        chunk_next += n;
+        count += n;
+        continue;
+      }
+      auto value = next_ref();
+      if(!value) {
+        break;
+      }
+      out[count ++] = *value;
     }
-    return nested->next();
+    return count;
   }
 
   /** @brief Called when a value is yielded.
    *         co_yield XXX = co_await yield_value(XXX)
+   *         A temporary in the co_yield expression lives until the coroutine is resumed, so it is not copied either.
    */
+  auto& yield_value(YieldType& value) {
+    ASYNCIO_TRACE("Generator (", this->promise_id, ") yielded ", value);
+    root->yielded_ptr = std::addressof(value);
+    // To imitate Python's send(), replace SendAwaitable with a user-defined sender
+    return sender;
+  }
+
+  auto& yield_value(YieldType&& value) {
+    return yield_value(value);
+  }
+
   template<CONVERTIBLE_TO(YieldType) From>
   auto& yield_value(From&& value) {
-    std::cout << "Generator (" << this->promise_id << ") yielded " << value << std::endl;
-    yielded_value = std::forward<From>(value);
-    // To imitate Python's send(), replace SendAwaitable with a user-defined sender
+    ASYNCIO_TRACE("Generator (", this->promise_id, ") yielded ", value);
+    root->yielded_storage = std::forward<From>(value);
+    root->yielded_ptr = std::addressof(*root->yielded_storage);
     return sender;
   }
+
+  /** @brief Suspends unless the chunk is empty.
+   */
+  struct chunk_awaiter {
+    bool empty;
+
+    constexpr bool await_ready() const noexcept {
+      return empty;
+    }
+
+    constexpr void await_suspend(coroutine_handle<>) const noexcept {}
+
+    constexpr void await_resume() const noexcept {}
+  };
+
+  chunk_awaiter yield_value(elements_of<YieldType> chunk) {
+    ASYNCIO_TRACE("Generator (", this->promise_id, ") yielded ", chunk.elements.size(), " elements");
+    if(chunk.elements.empty()) {
+      return chunk_awaiter{true};
+    }
+    root->yielded_ptr = chunk.elements.data();
+    root->chunk_next = chunk.elements.data() + 1;
+    root->chunk_end = chunk.elements.data() + chunk.elements.size();
+    return chunk_awaiter{false};
+  }
 };
 
 template<typename YieldType, typename SendAwaitable = suspend_always>
@@ -100,7 +253,7 @@ struct void_promise: public chainable_promise<YieldType, SendAwaitable> {
   /** @brief Called on co_return.
    */
   void return_void() {
-    std::cout << "Generator (" << this->promise_id << ") returned void" << std::endl;
+    ASYNCIO_TRACE("Generator (", this->promise_id, ") returned void");
     this->done = true;
   }
 };
@@ -115,101 +268,135 @@ struct ret_value_promise: public chainable_promise<YieldType, SendAwaitable> {
 
   template<CONVERTIBLE_TO(ReturnType) From>
   void return_value(From&& value) {
-    std::cout << "Generator (" << this->promise_id << ") returned " << value << std::endl;
+    ASYNCIO_TRACE("Generator (", this->promise_id, ") returned ", value);
     returned_value = std::forward<From>(value);
     this->done = true;
   }
 };
 
-template <typename YieldType, typename SendAwaitable = suspend_always>
-struct base_generator: public abstract_fiber<YieldType> {
+/** @brief Common part of generators.
+ *         Derived provides the coroutine handle, and is called statically so that next() can be inlined.
+ *         A generator is a move-only std::ranges::input_range and view, so std::ranges algorithms and views
+ *         can consume it directly.
+ */
+template <typename Derived, typename YieldType, typename SendAwaitable = suspend_always>
+struct base_generator: public std::ranges::view_base {
+  using yield_type = YieldType;
   using base_promise_type = chainable_promise<YieldType, SendAwaitable>;
-  virtual base_promise_type& promise() = 0;
-  virtual const base_promise_type& promise() const = 0;
-  virtual void resume() = 0;
-
-  std::optional<YieldType> next() override {
-    // If there is a chained generator, run the inner one first.
-    // Note: the inner one may exit immediately.
-    auto& promise = this->promise();
-    std::cout << "Generator (" << promise.promise_id << ") next() called" << std::endl;
-    auto nested_yield = promise.wait_nested();
-    if(nested_yield.has_value()) {
-      std::cout << "Generator (" << promise.promise_id << ") yielded from inner generator with "
-                << nested_yield.value() << std::endl;
-      return nested_yield.value();
-    }
-    do {
-      // This is used to handle the case when inner generator finishes immediately
-      // So we call resume() again to trigger await_resume to set the value
-      promise.no_yield_finish = false;
-      std::cout << "Generator (" << promise.promise_id << ") ready to resume in next()" << std::endl;
-      resume();
-      std::cout << "Generator (" << promise.promise_id << ") resumed in next()" << std::endl;
-      if(promise.error){
-        std::rethrow_exception(promise.error);
-      } else if(promise.done){
-        return std::nullopt;
-      }
-    } while (promise.no_yield_finish);
-    return promise.yielded_value;
+
+  base_promise_type& promise() {
+    return static_cast<Derived*>(this)->handle.promise();
   }
 
-  bool is_done() const noexcept override {
+  const base_promise_type& promise() const {
+    return static_cast<const Derived*>(this)->handle.promise();
+  }
+
+  void resume() {
+    static_cast<Derived*>(this)->handle.resume();
+  }
+
+  /** @brief Continues the execution.
+   *  @pre is_done() == false.
+   *  @return A copy of the value if the generator calls co_yield on some value.
+   *          std::nullopt if the generator co_return.
+   */
+  std::optional<YieldType> next() {
+    auto value = promise().next_ref();
+    if(!value) {
+      return std::nullopt;
+    }
+    return *value;
+  }
+
+  /** @brief Continues the execution without copying the yielded value.
+   *  @pre is_done() == false.
+   *  @return Pointer to the yielded value, which is valid until the generator is resumed or destroyed.
+   *          nullptr if the generator co_return.
+   */
+  YieldType* next_ref() {
+    return promise().next_ref();
+  }
+
+  /** @brief Copies up to out.size() values into out, resuming the generator only when needed.
+   *  @return The number of values written, which is less than out.size() only if the generator co_return.
+   */
+  size_t next_batch(std::span<YieldType> out) {
+    return promise().next_batch(out);
+  }
+
+  /** @brief Writes up to count values to an output iterator.
+   *  @return The number of values written.
+   */
+  template<typename OutputIt>
+  size_t take_into(OutputIt out, size_t count) {
+    size_t taken = 0;
+    YieldType* value;
+    while(taken < count && (value = next_ref())) {
+      *out ++ = *value;
+      taken ++;
+    }
+    return taken;
+  }
+
+  bool is_done() const noexcept {
     return promise().done;
   }
 
   /** @brief Called when the generator is awaited.
-   *         Here we want to use await_suspend to set the outer generator's nested field,
-   *         so always suspend.
+   *         Suspends the outer generator and transfers into this one, which yields to the outermost consumer.
    */
   bool await_ready() const noexcept {
-    std::cout << "Generator (" << promise().promise_id << ") is awaited" << std::endl;
-    return false;
+    ASYNCIO_TRACE("Generator (", promise().promise_id, ") is awaited");
+    return promise().done;
   }
 
   template<CONVERTIBLE_TO(base_promise_type) outer_promise_type>
-  void await_suspend(coroutine_handle<outer_promise_type> outer) {
+  coroutine_handle<> await_suspend(coroutine_handle<outer_promise_type> outer) {
     base_promise_type& outer_promise = outer.promise();
-    std::cout << "Generator (" << promise().promise_id << ") is suspended to be chained after ("
-              << outer_promise.promise_id << ")" << std::endl;
-    outer_promise.chain(this);
-    outer_promise.yielded_value = next();
-    if(promise().done) {
-      std::cout << "Generator (" << promise().promise_id << ") finished immediately without yielding" << std::endl;
-      outer_promise.no_yield_finish = true;
-    }
+    ASYNCIO_TRACE("Generator (", promise().promise_id, ") is chained after (", outer_promise.promise_id, ")");
+    return promise().chain(outer_promise);
   }
 
-  /** @brief used to implement range-based loop
+  /** @brief Input iterator over the yielded values, ended by std::default_sentinel.
+   *         It refers to the promise, so it stays valid if the generator object is moved.
    */
-  struct iterator{
-    base_generator* gen;
-    std::optional<YieldType> value;
+  struct iterator {
+    using iterator_concept = std::input_iterator_tag;
+    using value_type = std::remove_cv_t<YieldType>;
+    using difference_type = std::ptrdiff_t;
+    using reference = YieldType&;
+
+    base_promise_type* promise = nullptr;
+    YieldType* value = nullptr;
 
-    iterator& operator++(){
-      value = gen->next();
+    iterator& operator++() {
+      value = promise->next_ref();
       return *this;
     }
 
-    bool operator!=(bool){
-      return !gen->is_done();
+    void operator++(int) {
+      ++ *this;
+    }
+
+    YieldType& operator*() const {
+      return *value;
     }
 
-    YieldType operator*() {
-      return value.value();
+    friend bool operator==(const iterator& it, std::default_sentinel_t) noexcept {
+      return it.value == nullptr;
     }
   };
 
   iterator begin() {
     return iterator{
-      .gen = this,
-      .value = next(),
+      .promise = &promise(),
+      .value = next_ref(),
     };
   }
 
-  constexpr bool end() {
-    return false;
+  constexpr std::default_sentinel_t end() const noexcept {
+    return std::default_sentinel;
   }
 };
 
@@ -217,7 +404,7 @@ template <typename YieldType, typename ReturnType = void>
 struct generator;
 
 template <typename YieldType>
-struct generator<YieldType, void>: public base_generator<YieldType> {
+struct generator<YieldType, void>: public base_generator<generator<YieldType, void>, YieldType> {
   using base_promise_type = chainable_promise<YieldType, suspend_always>;
   struct promise_type: public void_promise<YieldType, suspend_always> {
     generator get_return_object() {
@@ -227,37 +414,50 @@ struct generator<YieldType, void>: public base_generator<YieldType> {
 
   generator(const coroutine_handle<promise_type>& handle):
     handle(handle)
-  {}
-
-  ~generator() override {
-    std::cout << "Generator (" << promise().promise_id << ") destroyed" << std::endl;
-    handle.destroy();
+  {
+    handle.promise().self = handle;
   }
 
-  coroutine_handle<promise_type> handle;
+  generator(const generator&) = delete;
+  void operator=(const generator&) = delete;
 
-  void await_resume() const {
-    std::cout << "Generator (" << promise().promise_id << ") await_resumed" << std::endl;
-    if(!handle.promise().done){
-      throw resume_unfinished{};
+  generator(generator&& rhs) noexcept:
+    handle(std::exchange(rhs.handle, nullptr))
+  {}
+
+  generator& operator=(generator&& rhs) noexcept {
+    if(this != &rhs) {
+      if(handle) {
+        handle.destroy();
+      }
+      handle = std::exchange(rhs.handle, nullptr);
     }
+    return *this;
   }
 
-  base_promise_type& promise() override {
-    return handle.promise();
+  ~generator() {
+    if(handle) {
+      ASYNCIO_TRACE("Generator (", handle.promise().promise_id, ") destroyed");
+      handle.destroy();
+    }
   }
 
-  const base_promise_type& promise() const override {
-    return handle.promise();
-  }
+  coroutine_handle<promise_type> handle;
 
-  virtual void resume() override {
-    handle.resume();
+  void await_resume() const {
+    ASYNCIO_TRACE("Generator (", this->promise().promise_id, ") await_resumed");
+    const auto& promise = handle.promise();
+    if(promise.error) {
+      std::rethrow_exception(promise.error);
+    }
+    if(!promise.done){
+      throw resume_unfinished{};
+    }
   }
 };
 
 template <typename YieldType, typename ReturnType>
-struct generator: public base_generator<YieldType> {
+struct generator: public base_generator<generator<YieldType, ReturnType>, YieldType> {
   using base_promise_type = chainable_promise<YieldType, suspend_always>;
   struct promise_type: public ret_value_promise<YieldType, ReturnType, suspend_always> {
     generator get_return_object() {
@@ -267,11 +467,32 @@ struct generator: public base_generator<YieldType> {
 
   generator(const coroutine_handle<promise_type>& handle):
     handle(handle)
+  {
+    handle.promise().self = handle;
+  }
+
+  generator(const generator&) = delete;
+  void operator=(const generator&) = delete;
+
+  generator(generator&& rhs) noexcept:
+    handle(std::exchange(rhs.handle, nullptr))
   {}
 
-  ~generator() override {
-    std::cout << "Generator (" << promise().promise_id << ") destroyed" << std::endl;
-    handle.destroy();
+  generator& operator=(generator&& rhs) noexcept {
+    if(this != &rhs) {
+      if(handle) {
+        handle.destroy();
+      }
+      handle = std::exchange(rhs.handle, nullptr);
+    }
+    return *this;
+  }
+
+  ~generator() {
+    if(handle) {
+      ASYNCIO_TRACE("Generator (", handle.promise().promise_id, ") destroyed");
+      handle.destroy();
+    }
   }
 
   coroutine_handle<promise_type> handle;
@@ -285,24 +506,16 @@ struct generator: public base_generator<YieldType> {
   }
 
   ReturnType await_resume() const {
-    std::cout << "Generator (" << promise().promise_id << ") await_resumed" << std::endl;
-    if(!handle.promise().done){
+    ASYNCIO_TRACE("Generator (", this->promise().promise_id, ") await_resumed");
+    const auto& promise = handle.promise();
+    if(promise.error) {
+      std::rethrow_exception(promise.error);
+    }
+    if(!promise.done){
       throw resume_unfinished{};
     }
     return result();
   }
-
-  base_promise_type& promise() override {
-    return handle.promise();
-  }
-
-  const base_promise_type& promise() const override {
-    return handle.promise();
-  }
-
-  virtual void resume() override {
-    handle.resume();
-  }
 };
 
 template<typename SendType>
@@ -320,12 +533,12 @@ struct send_awaitable {
 
   template<CONVERTIBLE_TO(SendType) From>
   void send(From&& input) {
-    std::cout << "sender obtained value " << input << std::endl;
+    ASYNCIO_TRACE("sender obtained value ", input);
     *value = std::forward<From>(input);
   }
 
   SendType await_resume() const noexcept {
-    std::cout << "sender passed value " << value->value() << " to co_yield caller" << std::endl;
+    ASYNCIO_TRACE("sender passed value ", value->value(), " to co_yield caller");
     return value->value();
   }
 };
@@ -335,7 +548,9 @@ template <typename YieldType, typename SendType, typename ReturnType = void>
 struct send_generator;
 
 template <typename YieldType, typename SendType>
-struct send_generator<YieldType, SendType, void>: public base_generator<YieldType, send_awaitable<SendType>> {
+struct send_generator<YieldType, SendType, void>:
+  public base_generator<send_generator<YieldType, SendType, void>, YieldType, send_awaitable<SendType>>
+{
   using base_promise_type = chainable_promise<YieldType, send_awaitable<SendType>>;
   struct promise_type: public void_promise<YieldType, send_awaitable<SendType>> {
     send_generator get_return_object() {
@@ -349,24 +564,40 @@ struct send_generator<YieldType, SendType, void>: public base_generator<YieldTyp
   send_generator(const coroutine_handle<promise_type>& handle):
     handle(handle), send_value(std::nullopt)
   {
+    handle.promise().self = handle;
     handle.promise().sender.value = &send_value;
   }
 
-  ~send_generator() override {
-    std::cout << "SendGenerator (" << promise().promise_id << ") destroyed" << std::endl;
-    handle.destroy();
-  }
+  send_generator(const send_generator&) = delete;
+  void operator=(const send_generator&) = delete;
 
-  base_promise_type& promise() override {
-    return handle.promise();
+  send_generator(send_generator&& rhs) noexcept:
+    handle(std::exchange(rhs.handle, nullptr)), send_value(std::move(rhs.send_value))
+  {
+    if(handle) {
+      handle.promise().sender.value = &send_value;
+    }
   }
 
-  const base_promise_type& promise() const override {
-    return handle.promise();
+  send_generator& operator=(send_generator&& rhs) noexcept {
+    if(this != &rhs) {
+      if(handle) {
+        handle.destroy();
+      }
+      handle = std::exchange(rhs.handle, nullptr);
+      send_value = std::move(rhs.send_value);
+      if(handle) {
+        handle.promise().sender.value = &send_value;
+      }
+    }
+    return *this;
   }
 
-  virtual void resume() override {
-    handle.resume();
+  ~send_generator() {
+    if(handle) {
+      ASYNCIO_TRACE("SendGenerator (", handle.promise().promise_id, ") destroyed");
+      handle.destroy();
+    }
   }
 
   template<CONVERTIBLE_TO(SendType) From>
@@ -377,7 +608,9 @@ struct send_generator<YieldType, SendType, void>: public base_generator<YieldTyp
 };
 
 template <typename YieldType, typename SendType, typename ReturnType>
-struct send_generator: public base_generator<YieldType, send_awaitable<SendType>> {
+struct send_generator:
+  public base_generator<send_generator<YieldType, SendType, ReturnType>, YieldType, send_awaitable<SendType>>
+{
   using base_promise_type = chainable_promise<YieldType, send_awaitable<SendType>>;
   struct promise_type: public ret_value_promise<YieldType, ReturnType, send_awaitable<SendType>> {
     send_generator get_return_object() {
@@ -391,12 +624,40 @@ struct send_generator: public base_generator<YieldType, send_awaitable<SendType>
   send_generator(const coroutine_handle<promise_type>& handle):
     handle(handle), send_value(std::nullopt)
   {
+    handle.promise().self = handle;
     handle.promise().sender.value = &send_value;
   }
 
-  ~send_generator() override {
-    std::cout << "SendGenerator (" << promise().promise_id << ") destroyed" << std::endl;
-    handle.destroy();
+  send_generator(const send_generator&) = delete;
+  void operator=(const send_generator&) = delete;
+
+  send_generator(send_generator&& rhs) noexcept:
+    handle(std::exchange(rhs.handle, nullptr)), send_value(std::move(rhs.send_value))
+  {
+    if(handle) {
+      handle.promise().sender.value = &send_value;
+    }
+  }
+
+  send_generator& operator=(send_generator&& rhs) noexcept {
+    if(this != &rhs) {
+      if(handle) {
+        handle.destroy();
+      }
+      handle = std::exchange(rhs.handle, nullptr);
+      send_value = std::move(rhs.send_value);
+      if(handle) {
+        handle.promise().sender.value = &send_value;
+      }
+    }
+    return *this;
+  }
+
+  ~send_generator() {
+    if(handle) {
+      ASYNCIO_TRACE("SendGenerator (", handle.promise().promise_id, ") destroyed");
+      handle.destroy();
+    }
   }
 
   ReturnType result() const {
@@ -407,22 +668,31 @@ struct send_generator: public base_generator<YieldType, send_awaitable<SendType>
     return promise.returned_value.value();
   }
 
-  base_promise_type& promise() override {
-    return handle.promise();
+  template<CONVERTIBLE_TO(SendType) From>
+  std::optional<YieldType> send(From&& input) {
+    handle.promise().sender.send(input);
+    return this->next();
   }
+};
 
-  const base_promise_type& promise() const override {
-    return handle.promise();
-  }
+/** @brief Owns a generator behind the type-erased abstract_fiber interface.
+ */
+template<typename Generator>
+struct fiber: public abstract_fiber<typename Generator::yield_type> {
+  using yield_type = typename Generator::yield_type;
+
+  Generator gen;
 
-  virtual void resume() override {
-    handle.resume();
+  fiber(Generator&& gen):
+    gen(std::move(gen))
+  {}
+
+  bool is_done() const noexcept override {
+    return gen.is_done();
   }
 
-  template<CONVERTIBLE_TO(SendType) From>
-  std::optional<YieldType> send(From&& input) {
-    handle.promise().sender.send(input);
-    return this->next();
+  std::optional<yield_type> next() override {
+    return gen.next();
   }
 };
 
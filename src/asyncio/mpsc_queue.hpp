@@ -0,0 +1,73 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <utility>
+
+namespace asyncio {
+
+/** @brief A lock-free multi-producer single-consumer queue.
+ *         Producers push onto an atomic stack; the consumer takes the whole stack at once
+ *         and reverses it, so values are consumed in the order they were pushed.
+ */
+template<typename T>
+struct mpsc_queue {
+  struct node {
+    T value;
+    node* next;
+  };
+
+  std::atomic<node*> head;
+
+  mpsc_queue():
+    head(nullptr)
+  {}
+
+  mpsc_queue(const mpsc_queue&) = delete;
+  void operator=(const mpsc_queue&) = delete;
+
+  ~mpsc_queue() {
+    drain([](T&) {});
+  }
+
+  /** @brief Safe to call from any thread.
+   */
+  void push(T value) {
+    auto n = new node{std::move(value), head.load(std::memory_order_relaxed)};
+    while(!head.compare_exchange_weak(n->next, n, std::memory_order_seq_cst, std::memory_order_relaxed)) {
+    }
+  }
+
+  /** @brief Sequentially consistent, so that a consumer publishing "I am going to sleep" before calling empty()
+   *         and a producer checking that flag after push() cannot miss each other.
+   */
+  bool empty() const noexcept {
+    return head.load(std::memory_order_seq_cst) == nullptr;
+  }
+
+  /** @brief Consumer only. Calls fn on every queued value in FIFO order.
+   *  @return The number of values consumed.
+   */
+  template<typename Fn>
+  size_t drain(Fn&& fn) {
+    node* n = head.exchange(nullptr, std::memory_order_acquire);
+    node* fifo = nullptr;
+    while(n) {
+      auto next = n->next;
+      n->next = fifo;
+      fifo = n;
+      n = next;
+    }
+    size_t count = 0;
+    while(fifo) {
+      auto next = fifo->next;
+      fn(fifo->value);
+      delete fifo;
+      fifo = next;
+      count ++;
+    }
+    return count;
+  }
+};
+
+} // namespace asyncio
@@ -0,0 +1,196 @@
+#pragma once
+
+#include <cstddef>
+#include <functional>
+#include <iterator>
+#include <optional>
+#include <span>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+namespace asyncio {
+
+/** @brief Lazy adaptors over anything with next_ref(), such as generators: gen | map(f) | filter(p) | take(n).
+ *         Each stage is a plain object that pulls from its upstream when it is pulled, so a pipeline is
+ *         one loop that the compiler can inline, without a coroutine frame or a resume per stage.
+ *         Every stage follows the protocol of base_generator::next_ref(): it returns a pointer to the
+ *         current value, valid until the next pull, or nullptr at the end.
+ *         An upstream passed as an lvalue is referenced by the pipeline; an rvalue is moved into it.
+ */
+template<typename Upstream>
+using pipeline_value_t = std::remove_pointer_t<decltype(std::declval<Upstream&>().next_ref())>;
+
+/** @brief Iteration shared by all stages.
+ */
+template<typename Derived>
+struct pipeline_view {
+  /** @brief Pulls the next value by copy.
+   *  @return std::nullopt at the end.
+   */
+  auto next() {
+    auto value = static_cast<Derived*>(this)->next_ref();
+    using value_type = std::remove_cv_t<std::remove_pointer_t<decltype(value)>>;
+    return value ? std::optional<value_type>(*value) : std::nullopt;
+  }
+
+  /** @brief Input iterator like base_generator::iterator, so a pipeline is a std::ranges::input_range.
+   */
+  struct iterator {
+    using iterator_concept = std::input_iterator_tag;
+    using value_type = std::remove_cv_t<pipeline_value_t<Derived>>;
+    using difference_type = std::ptrdiff_t;
+    using reference = pipeline_value_t<Derived>&;
+
+    Derived* view = nullptr;
+    pipeline_value_t<Derived>* value = nullptr;
+
+    iterator& operator++() {
+      value = view->next_ref();
+      return *this;
+    }
+
+    void operator++(int) {
+      ++ *this;
+    }
+
+    reference operator*() const {
+      return *value;
+    }
+
+    friend bool operator==(const iterator& it, std::default_sentinel_t) noexcept {
+      return it.value == nullptr;
+    }
+  };
+
+  iterator begin() {
+    auto self = static_cast<Derived*>(this);
+    return iterator{self, self->next_ref()};
+  }
+
+  constexpr std::default_sentinel_t end() const noexcept {
+    return std::default_sentinel;
+  }
+};
+
+template<typename Upstream, typename Fn>
+struct map_view: public pipeline_view<map_view<Upstream, Fn>> {
+  using value_type = std::remove_cvref_t<std::invoke_result_t<Fn&, pipeline_value_t<Upstream>&>>;
+
+  Upstream upstream;
+  Fn fn;
+  std::optional<value_type> current;
+
+  value_type* next_ref() {
+    auto value = upstream.next_ref();
+    if(!value) {
+      return nullptr;
+    }
+    current.emplace(std::invoke(fn, *value));
+    return &*current;
+  }
+};
+
+template<typename Upstream, typename Pred>
+struct filter_view: public pipeline_view<filter_view<Upstream, Pred>> {
+  Upstream upstream;
+  Pred pred;
+
+  pipeline_value_t<Upstream>* next_ref() {
+    auto value = upstream.next_ref();
+    while(value && !std::invoke(pred, std::as_const(*value))) {
+      value = upstream.next_ref();
+    }
+    return value;
+  }
+};
+
+template<typename Upstream>
+struct take_view: public pipeline_view<take_view<Upstream>> {
+  Upstream upstream;
+  size_t remaining;
+
+  pipeline_value_t<Upstream>* next_ref() {
+    // Do not resume the upstream once enough values are taken
+    if(remaining == 0) {
+      return nullptr;
+    }
+    remaining --;
+    return upstream.next_ref();
+  }
+};
+
+/** @brief Groups values into spans of up to size elements. The last one may be shorter.
+ */
+template<typename Upstream>
+struct chunk_view: public pipeline_view<chunk_view<Upstream>> {
+  using element_type = std::remove_cv_t<pipeline_value_t<Upstream>>;
+
+  Upstream upstream;
+  std::vector<element_type> buffer;
+  std::span<element_type> current;
+
+  chunk_view(Upstream&& upstream, size_t size):
+    upstream(std::forward<Upstream>(upstream)), buffer(size), current()
+  {}
+
+  std::span<element_type>* next_ref() {
+    size_t count = 0;
+    if constexpr(requires { upstream.next_batch(std::span<element_type>(buffer)); }) {
+      count = upstream.next_batch(std::span<element_type>(buffer));
+    } else {
+      for(; count < buffer.size(); count ++) {
+        auto value = upstream.next_ref();
+        if(!value) {
+          break;
+        }
+        buffer[count] = *value;
+      }
+    }
+    if(count == 0) {
+      return nullptr;
+    }
+    current = std::span<element_type>(buffer.data(), count);
+    return &current;
+  }
+};
+
+/** @brief A stage before it is bound to an upstream with operator|.
+ */
+template<typename Bind>
+struct pipeline_stage {
+  Bind bind;
+};
+
+template<typename Fn>
+auto map(Fn fn) {
+  return pipeline_stage{[fn = std::move(fn)]<typename Upstream>(Upstream&& upstream) mutable {
+    return map_view<Upstream, Fn>{{}, std::forward<Upstream>(upstream), std::move(fn), std::nullopt};
+  }};
+}
+
+template<typename Pred>
+auto filter(Pred pred) {
+  return pipeline_stage{[pred = std::move(pred)]<typename Upstream>(Upstream&& upstream) mutable {
+    return filter_view<Upstream, Pred>{{}, std::forward<Upstream>(upstream), std::move(pred)};
+  }};
+}
+
+inline auto take(size_t count) {
+  return pipeline_stage{[count]<typename Upstream>(Upstream&& upstream) {
+    return take_view<Upstream>{{}, std::forward<Upstream>(upstream), count};
+  }};
+}
+
+inline auto chunk(size_t size) {
+  return pipeline_stage{[size]<typename Upstream>(Upstream&& upstream) {
+    return chunk_view<Upstream>(std::forward<Upstream>(upstream), size);
+  }};
+}
+
+template<typename Upstream, typename Bind>
+auto operator|(Upstream&& upstream, pipeline_stage<Bind> stage) {
+  return std::move(stage.bind)(std::forward<Upstream>(upstream));
+}
+
+} // namespace asyncio
@@ -0,0 +1,108 @@
+#pragma once
+
+#include <exception>
+#include <memory>
+#include <optional>
+#include <thread>
+#include <type_traits>
+#include <utility>
+#include "pipeline.hpp"
+#include "spsc_ring.hpp"
+
+namespace asyncio {
+
+/** @brief Runs its upstream ahead on a worker thread: std::move(gen) | prefetch(depth).
+ *         Up to depth values are produced into a spsc_ring while the consumer works on earlier ones,
+ *         and the consumer pulls with next(), next_ref() or range-for as from any pipeline stage.
+ *         An exception thrown by the upstream is rethrown to the consumer after the values before it.
+ *         An owned upstream is destroyed on the worker thread once it finishes. A referenced upstream
+ *         must not be touched by anyone else while the prefetch_view is alive.
+ */
+template<typename Upstream>
+struct prefetch_view: public pipeline_view<prefetch_view<Upstream>> {
+  using value_type = std::remove_cv_t<pipeline_value_t<Upstream>>;
+
+  /** @brief State shared with the worker thread. It stays in place when the view is moved.
+   */
+  struct shared_state {
+    std::conditional_t<std::is_reference_v<Upstream>, std::remove_reference_t<Upstream>*, std::optional<Upstream>>
+      source;
+    spsc_ring<value_type> ring;
+    // Written by the worker before it closes the ring
+    std::exception_ptr error;
+
+    shared_state(Upstream&& upstream, size_t depth):
+      source(), ring(depth), error()
+    {
+      if constexpr(std::is_reference_v<Upstream>) {
+        source = &upstream;
+      } else {
+        source.emplace(std::move(upstream));
+      }
+    }
+
+    void produce() {
+      try {
+        while(auto value = (*source).next_ref()) {
+          if(!ring.push(*value)) {
+            break;
+          }
+        }
+      } catch(...) {
+        error = std::current_exception();
+      }
+      if constexpr(!std::is_reference_v<Upstream>) {
+        source.reset();
+      }
+      ring.close();
+    }
+  };
+
+  std::unique_ptr<shared_state> state;
+  std::thread worker;
+  std::optional<value_type> current;
+  bool finished;
+
+  prefetch_view(Upstream&& upstream, size_t depth):
+    state(std::make_unique<shared_state>(std::forward<Upstream>(upstream), depth)),
+    worker(), current(std::nullopt), finished(false)
+  {
+    worker = std::thread([state = state.get()] {
+      state->produce();
+    });
+  }
+
+  prefetch_view(prefetch_view&&) = default;
+
+  ~prefetch_view() {
+    if(worker.joinable()) {
+      state->ring.cancel();
+      worker.join();
+    }
+  }
+
+  value_type* next_ref() {
+    if(finished) {
+      return nullptr;
+    }
+    current = state->ring.pop();
+    if(!current) {
+      finished = true;
+      if(state->error) {
+        std::rethrow_exception(state->error);
+      }
+      return nullptr;
+    }
+    return &*current;
+  }
+};
+
+/** @brief Stage that prefetches up to depth values on a worker thread.
+ */
+inline auto prefetch(size_t depth) {
+  return pipeline_stage{[depth]<typename Upstream>(Upstream&& upstream) {
+    return prefetch_view<Upstream>(std::forward<Upstream>(upstream), depth);
+  }};
+}
+
+} // namespace asyncio
@@ -0,0 +1,67 @@
+#pragma once
+
+#include "common.hpp"
+#include "utils.hpp"
+#include <cstddef>
+#include <utility>
+#include <vector>
+
+namespace asyncio {
+
+/** @brief FIFO of coroutines that are due, for one priority class.
+ *         It is a ring that doubles when full, so a steady flow of handles does not allocate.
+ */
+struct ready_queue {
+  struct entry {
+    coroutine_handle<> handle;
+    // When it became due, to measure how long it waits
+    time_point ready_at;
+  };
+
+  std::vector<entry> ring;
+  size_t head;
+  size_t count;
+
+  ready_queue():
+    ring(), head(0), count(0)
+  {}
+
+  bool empty() const noexcept {
+    return count == 0;
+  }
+
+  size_t size() const noexcept {
+    return count;
+  }
+
+  const entry& front() const noexcept {
+    return ring[head];
+  }
+
+  void push(coroutine_handle<> handle, time_point ready_at) {
+    if(count == ring.size()) {
+      grow();
+    }
+    ring[(head + count) % ring.size()] = entry{handle, ready_at};
+    count ++;
+  }
+
+  entry pop() noexcept {
+    auto ret = ring[head];
+    head = (head + 1) % ring.size();
+    count --;
+    return ret;
+  }
+
+private:
+  void grow() {
+    std::vector<entry> bigger(ring.empty() ? 64 : ring.size() * 2);
+    for(size_t i = 0; i < count; i ++) {
+      bigger[i] = ring[(head + i) % ring.size()];
+    }
+    ring = std::move(bigger);
+    head = 0;
+  }
+};
+
+} // namespace asyncio
@@ -3,86 +3,347 @@
 #include "common.hpp"
 #include "utils.hpp"
 #include "coroutine.hpp"
-#include <list>
+#include "task_group.hpp"
+#include "timer_heap.hpp"
+#include "ready_queue.hpp"
+#include "mpsc_queue.hpp"
+#include "thread_pool.hpp"
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <semaphore>
+#include <vector>
+#include <algorithm>
 #include <memory>
 #include <limits>
 
 namespace asyncio {
 
+/** @brief How an engine waits when nothing is due.
+ *         block parks the thread until the next deadline or a post(), which costs no CPU but adds
+ *         the wakeup latency of the OS. busy_poll never parks: every round polls, so a due timer or a
+ *         posted handle is picked up within a round, at the cost of a whole core. spin_then_block parks
+ *         until spin before the next deadline and polls from there, and polls for spin before parking
+ *         when nothing is scheduled, so work that arrives soon after the last one is picked up at once.
+ */
+enum class wait_mode {
+  block,
+  spin_then_block,
+  busy_poll,
+};
+
+struct wait_policy {
+  wait_mode mode = wait_mode::block;
+  duration spin = std::chrono::microseconds(50);
+};
+
+/** @brief A single-threaded engine. Timers wait in a heap until they are due, then join the ready queue
+ *         of their priority class. Each round resumes up to round_budget ready handles, highest class first,
+ *         and collects the newly due timers in between, so a backlog of bulk work does not delay a
+ *         keep-alive for longer than one round. A class passed over starvation_limit times in a row
+ *         while it has handles ready is resumed next.
+ */
 struct sleep_engine: public abstract_engine {
-  using event_data = std::pair<msec, coroutine_handle<>>;
+  static constexpr time_point forever = time_point::max();
 
-  std::list<event_data> events;  // A heap would be faster
-  std::list<std::unique_ptr<abstract_task>> owned_tasks;
+  timer_heap events;
+  std::array<ready_queue, priority_count> ready;
+  // How many times in a row each class has been passed over while it had handles ready
+  std::array<size_t, priority_count> skipped;
+  size_t starvation_limit;
+  size_t round_budget;
+  // Per-class delay between becoming due and being resumed, if measure_latency is set
+  bool measure_latency;
+  std::array<latency_stats, priority_count> latency;
+  time_point round_start;
+  wait_policy policy;
+  // When the engine last ran out of work, for spin_then_block
+  time_point idle_since;
   timer tmer;
+  struct posted_handle {
+    coroutine_handle<> handle;
+    priority prio;
+  };
+  // Handles posted from other threads, moved into the ready queues at the beginning of each round
+  mpsc_queue<posted_handle> posted;
+  std::atomic<size_t> external_work;
+  // Set while the engine blocks in wait(); a poster that clears it must wake the engine up
+  std::atomic<bool> parked;
+  std::binary_semaphore wakeup;
+  // Runs the jobs of run_in_pool(); created on first use. Declared last so that it is joined
+  // while the queues its jobs post to are still alive.
+  size_t pool_size;
+  std::unique_ptr<thread_pool> pool;
 
-  sleep_engine() {}
+  sleep_engine():
+    events(), ready(), skipped(), starvation_limit(16), round_budget(64), measure_latency(false), latency(),
+    round_start(), policy(), idle_since(), tmer(), posted(), external_work(0), parked(false), wakeup(0),
+    pool_size(std::thread::hardware_concurrency()), pool()
+  {}
 
-  void schedule(coroutine_handle<> handle, msec tim) override {
-    events.push_back(std::make_pair(tim, handle));
+  void schedule(coroutine_handle<> handle, time_point tim, priority prio = priority::normal) override {
+    if(tim == asap) {
+      push_ready(handle, prio);
+    } else {
+      events.push(tim, handle, nullptr, prio);
+    }
   }
 
-  bool is_scheduled(coroutine_handle<> handle) const override {
-    for(const auto &e: events) {
-      if(e.second.address() == handle.address()) {
-        return true;
-      }
+  void schedule_timer(timer_entry& entry) override {
+    if(entry.cancelled) {
+      push_ready(entry.handle, entry.prio);
+    } else {
+      events.push(entry);
     }
-    return false;
   }
 
+  /** @brief Must be called on the engine thread, like schedule().
+   */
+  void cancel_timer(timer_entry& entry) override {
+    if(events.erase(entry)) {
+      push_ready(entry.handle, entry.prio);
+    } else {
+      entry.cancelled = true;
+    }
+  }
+
+  void post(coroutine_handle<> handle, priority prio = priority::normal) override {
+    posted.push(posted_handle{handle, prio});
+    notify();
+  }
+
+  void add_work() noexcept override {
+    external_work.fetch_add(1, std::memory_order_relaxed);
+  }
+
+  void remove_work() noexcept override {
+    if(external_work.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+      // Let run() re-check whether it should stop
+      notify();
+    }
+  }
+
+  /** @param prio The priority class of the task, unless it is set with task.set_priority().
+   */
   template<typename T>
-  void schedule_task(task<T>& task, msec after) {
+  void schedule_task(task<T>& task, duration after = duration::zero(), priority prio = priority::normal) {
     task.set_engine(*this);
-    schedule(task.handle, tmer.now() + after);
+    auto& promise = task.handle.promise();
+    if(!promise.prio) {
+      promise.prio = prio;
+    }
+    promise.schedule_once(task.handle, tmer.now() + after);
   }
 
-  sleep_awaiter sleep(msec duration) {
-    auto awake_at = tmer.now() + duration;
+  /** @brief Enables the per-class latency histograms, at the cost of a clock read per resume.
+   */
+  void set_latency_metrics(bool enabled) {
+    measure_latency = enabled;
+  }
+
+  const latency_stats& latency_of(priority prio) const noexcept {
+    return latency[static_cast<size_t>(prio)];
+  }
+
+  void reset_latency_metrics() noexcept {
+    latency = {};
+  }
+
+  void set_starvation_limit(size_t limit) noexcept {
+    starvation_limit = limit;
+  }
+
+  void set_wait_policy(wait_policy new_policy) noexcept {
+    policy = new_policy;
+  }
+
+  /** @brief Applies the wait policy to the deadline of the next due handle.
+   *         Polling is wait(asap), which returns at once (after checking the fds of an epoll_engine),
+   *         so the round loop spins on it.
+   */
+  time_point wait_deadline(time_point deadline) {
+    if(deadline == asap || policy.mode == wait_mode::block) {
+      return deadline;
+    }
+    if(policy.mode == wait_mode::busy_poll) {
+      return asap;
+    }
+    auto now = tmer.now();
+    if(deadline != forever) {
+      // Park until shortly before the deadline, then spin to it
+      return deadline - now > policy.spin ? deadline - policy.spin : asap;
+    }
+    // Nothing is scheduled: spin for a while in case something is posted, then park
+    if(idle_since == time_point{}) {
+      idle_since = now;
+    }
+    return now - idle_since < policy.spin ? asap : forever;
+  }
+
+  /** @brief schedule_task() that is safe to call from any thread.
+   *  @pre The task object outlives the task, and no other thread touches it until it is done.
+   */
+  template<typename T>
+  void post_task(task<T>& task) {
+    task.set_engine(*this);
+    if(task.state.try_start()) {
+      post(task.handle, task.handle.promise().prio.value_or(priority::normal));
+    }
+  }
+
+  /** @brief Sets the number of threads used by run_in_pool().
+   *         Only takes effect before the first call to run_in_pool().
+   */
+  void set_pool_size(size_t threads) {
+    pool_size = threads;
+  }
+
+  thread_pool& get_pool() {
+    if(!pool) {
+      pool = std::make_unique<thread_pool>(pool_size);
+    }
+    return *pool;
+  }
+
+  /** @brief co_await engine.run_in_pool(fn) runs fn() on the engine's thread pool,
+   *         and resumes the caller on the engine thread with its result.
+   */
+  template<typename Fn>
+  auto run_in_pool(Fn&& fn) {
+    return asyncio::run_in_pool(get_pool(), std::forward<Fn>(fn));
+  }
+
+  sleep_awaiter sleep(duration length) {
+    auto awake_at = tmer.now() + length;
     return sleep_awaiter(this, awake_at);
   }
 
-  void run_one_round() {
-    // Get least sleep time
-    msec least_await = std::numeric_limits<msec>::max();
-    for(auto& e: events) {
-      least_await = std::min(e.first, least_await);
+  /** @brief Blocks until an absolute deadline, or until woken up if deadline is forever.
+   *         Derived engines override this to wait for other event sources in the meantime;
+   *         they should return early once something is posted.
+   */
+  virtual void wait(time_point deadline) {
+    if(deadline <= tmer.now()) {
+      return;
     }
-    // Sleep until the first executable task
-    msec now = tmer.now();
-    if(least_await > now) {
-      tmer.sleep(least_await - now);
-    }
-    now = tmer.now();
-    // Execute scheduled tasks
-    for(auto it = events.begin(); it != events.end(); ){
-      if(it->first <= now) {
-        std::cout << "engine resumes " << it->second.address() << std::endl;
-        it->second.resume();
-        it = events.erase(it);
+    // Either we see the posted handle, or the poster sees parked (both sides are seq_cst)
+    parked.store(true, std::memory_order_seq_cst);
+    bool acquired = false;
+    if(posted.empty()) {
+      if(deadline == forever) {
+        wakeup.acquire();
+        acquired = true;
       } else {
-        ++ it;
+        // Waits on a futex with an absolute CLOCK_MONOTONIC deadline
+        acquired = wakeup.try_acquire_until(deadline);
       }
     }
-    // Remove finished owned tasks
-    for(auto it = owned_tasks.begin(); it != owned_tasks.end(); ){
-      if((*it)->is_done()) {
-        std::cout << "engine removed a finished task" <<std::endl;
-        it = owned_tasks.erase(it);
+    if(!acquired && !parked.exchange(false, std::memory_order_acq_rel)) {
+      // A poster has cleared parked and is about to release the semaphore; consume it
+      wakeup.acquire();
+    }
+  }
+
+  /** @brief Wakes up the engine if it is blocked in wait().
+   */
+  virtual void notify() {
+    if(parked.exchange(false, std::memory_order_seq_cst)) {
+      wakeup.release();
+    }
+  }
+
+  /** @brief Whether run() should keep running.
+   */
+  virtual bool has_pending() const {
+    return has_ready() || !events.empty() || !posted.empty() || external_work.load(std::memory_order_acquire) > 0;
+  }
+
+  bool has_ready() const noexcept {
+    for(auto& queue: ready) {
+      if(!queue.empty()) {
+        return true;
+      }
+    }
+    return false;
+  }
+
+  void push_ready(coroutine_handle<> handle, priority prio) {
+    ready[static_cast<size_t>(prio)].push(handle, measure_latency ? tmer.now() : round_start);
+  }
+
+  /** @return The class to resume next, or priority_count if nothing is ready.
+   */
+  size_t next_class() noexcept {
+    size_t chosen = priority_count;
+    bool starving = false;
+    for(size_t cls = 0; cls < priority_count; cls ++) {
+      if(ready[cls].empty()) {
+        skipped[cls] = 0;
+      } else if(chosen == priority_count) {
+        chosen = cls;
+      } else if(!starving && skipped[cls] >= starvation_limit) {
+        // The highest starving class goes first
+        skipped[chosen] ++;
+        chosen = cls;
+        starving = true;
       } else {
-        ++ it;
+        skipped[cls] ++;
+      }
+    }
+    if(chosen != priority_count) {
+      skipped[chosen] = 0;
+    }
+    return chosen;
+  }
+
+  void run_one_round() {
+    // Sleep until the first executable task
+    auto next_due = has_ready() ? asap : events.empty() ? forever : events.top().awake_at;
+    auto deadline = wait_deadline(next_due);
+    if(deadline == asap && next_due != asap) {
+      cpu_relax();
+    }
+    wait(deadline);
+    posted.drain([this](posted_handle& entry) {
+      schedule(entry.handle, asap, entry.prio);
+    });
+    auto now = tmer.now();
+    round_start = now;
+    // Due timers keep their deadline as the time they became ready
+    while(!events.empty() && events.top().awake_at <= now) {
+      auto ready_at = events.top().awake_at;
+      auto prio = events.top().prio;
+      ready[static_cast<size_t>(prio)].push(events.pop(), ready_at);
+    }
+    // Handles scheduled asap by the resumed coroutines join the queues and may run in this round.
+    for(size_t count = 0; count < round_budget; count ++) {
+      auto cls = next_class();
+      if(cls == priority_count) {
+        break;
+      }
+      auto entry = ready[cls].pop();
+      if(measure_latency) {
+        latency[cls].record(tmer.now() - entry.ready_at);
       }
+      ASYNCIO_TRACE("engine resumes ", entry.handle.address());
+      entry.handle.resume();
+      idle_since = time_point{};
     }
   }
 
   void run() {
-    while(!events.empty()){
+    while(has_pending()){
       run_one_round();
     }
   }
 
+  /** @brief Frees the task object once the task finishes. Nothing is polled: a detached coroutine awaits it.
+   *  @pre The task is scheduled or running.
+   */
   void transfer_ownership(std::unique_ptr<abstract_task>&& task) {
-    owned_tasks.push_back(std::move(task));
+    auto owner = release_when_done(std::move(task));
+    owner.handle.promise().engine_ptr = this;
+    owner.handle.resume();
   }
 };
 
@@ -0,0 +1,84 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <optional>
+#include <semaphore>
+#include <utility>
+#include <vector>
+
+namespace asyncio {
+
+/** @brief A bounded single-producer single-consumer ring buffer with blocking push() and pop().
+ *         Each side owns its index; two semaphores count the free and filled slots,
+ *         and also order the slot accesses between the threads.
+ *         The producer ends the stream with close(); the consumer can give up early with cancel().
+ */
+template<typename T>
+struct spsc_ring {
+  // An empty slot marks the end of the stream
+  std::vector<std::optional<T>> slots;
+  std::counting_semaphore<> free_slots;
+  std::counting_semaphore<> filled_slots;
+  // Producer only
+  size_t tail;
+  // Consumer only
+  size_t head;
+  std::atomic<bool> cancelled;
+
+  explicit spsc_ring(size_t capacity):
+    // One more slot for the end mark
+    slots(capacity + 1), free_slots(static_cast<std::ptrdiff_t>(capacity + 1)), filled_slots(0),
+    tail(0), head(0), cancelled(false)
+  {}
+
+  spsc_ring(const spsc_ring&) = delete;
+  void operator=(const spsc_ring&) = delete;
+
+  /** @brief Producer only. Blocks while the ring is full.
+   *  @return false if the consumer has cancelled, in which case value is dropped.
+   */
+  bool push(T value) {
+    free_slots.acquire();
+    if(cancelled.load(std::memory_order_acquire)) {
+      return false;
+    }
+    slots[tail].emplace(std::move(value));
+    tail = (tail + 1) % slots.size();
+    filled_slots.release();
+    return true;
+  }
+
+  /** @brief Producer only. Ends the stream after the values pushed so far.
+   */
+  void close() {
+    free_slots.acquire();
+    if(cancelled.load(std::memory_order_acquire)) {
+      return;
+    }
+    slots[tail].reset();
+    tail = (tail + 1) % slots.size();
+    filled_slots.release();
+  }
+
+  /** @brief Consumer only. Blocks while the ring is empty.
+   *  @return The value, or std::nullopt once the stream is closed.
+   */
+  std::optional<T> pop() {
+    filled_slots.acquire();
+    auto value = std::move(slots[head]);
+    slots[head].reset();
+    head = (head + 1) % slots.size();
+    free_slots.release();
+    return value;
+  }
+
+  /** @brief Consumer only. Unblocks the producer, whose pushes fail from now on.
+   */
+  void cancel() {
+    cancelled.store(true, std::memory_order_release);
+    free_slots.release(static_cast<std::ptrdiff_t>(slots.size()));
+  }
+};
+
+} // namespace asyncio
@@ -0,0 +1,370 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <mutex>
+#include <utility>
+#include "common.hpp"
+#include "cancellation.hpp"
+#include "coroutine.hpp"
+
+namespace asyncio {
+
+/** @brief A coroutine waiting on a synchronization primitive. The node lives in its awaiter,
+ *         i.e. in the waiting frame, and is linked into the primitive's queue, so waiting does not allocate.
+ */
+struct sync_waiter {
+  enum class status { idle, queued, granted, cancelled };
+
+  coroutine_handle<> handle;
+  abstract_engine* engine_ptr;
+  priority prio;
+  sync_waiter* prev;
+  sync_waiter* next;
+  status state;
+};
+
+/** @brief An intrusive FIFO of waiters, protected by the mutex of its primitive.
+ */
+struct waiter_queue {
+  sync_waiter* head = nullptr;
+  sync_waiter* tail = nullptr;
+
+  bool empty() const noexcept {
+    return head == nullptr;
+  }
+
+  void push_back(sync_waiter& waiter) noexcept {
+    waiter.prev = tail;
+    waiter.next = nullptr;
+    if(tail) {
+      tail->next = &waiter;
+    } else {
+      head = &waiter;
+    }
+    tail = &waiter;
+  }
+
+  sync_waiter* pop_front() noexcept {
+    auto waiter = head;
+    if(waiter) {
+      erase(*waiter);
+    }
+    return waiter;
+  }
+
+  void erase(sync_waiter& waiter) noexcept {
+    (waiter.prev ? waiter.prev->next : head) = waiter.next;
+    (waiter.next ? waiter.next->prev : tail) = waiter.prev;
+    waiter.prev = nullptr;
+    waiter.next = nullptr;
+  }
+};
+
+/** @brief Schedules a waiter taken out of its queue on its engine. The waiter may be gone once this returns.
+ */
+inline void wake(sync_waiter& waiter, sync_waiter::status state = sync_waiter::status::granted) {
+  waiter.state = state;
+  waiter.engine_ptr->schedule(waiter.handle, asap, waiter.prio);
+}
+
+/** @brief Suspension shared by the primitives. Derived::try_complete() runs under the primitive's mutex and
+ *         either completes the operation at once, or returns false to queue the waiter until it is woken up.
+ *         If the waiting coroutine has a cancellation token, a queued waiter is removed on cancellation and
+ *         co_await throws operation_cancelled; a waiter that has been granted completes normally.
+ *         Waiters are resumed through abstract_engine::schedule(), so with a sleep_engine the primitive
+ *         must be used on the engine thread.
+ */
+template<typename Derived>
+struct sync_awaiter: public sync_waiter {
+  std::mutex& mutex;
+  waiter_queue& queue;
+  cancellation_token token;
+  cancellation_callback callback;
+
+  sync_awaiter(std::mutex& mutex, waiter_queue& queue):
+    sync_waiter{{}, nullptr, priority::normal, nullptr, nullptr, status::idle},
+    mutex(mutex), queue(queue), token(), callback()
+  {}
+
+  constexpr bool await_ready() const noexcept {
+    return false;
+  }
+
+  template<typename P>
+  bool await_suspend(coroutine_handle<P> caller) {
+    handle = caller;
+    engine_ptr = caller.promise().engine_ptr;
+    if(!engine_ptr) {
+      throw no_engine{};
+    }
+    prio = priority_of(caller);
+    token = token_of(caller);
+    if(token) {
+      // Registered before the waiter is queued, so that a waiter woken up on another thread
+      // never races with the registration
+      callback.fn = &sync_awaiter::cancel;
+      callback.context = this;
+      if(!token.register_callback(callback)) {
+        state = status::cancelled;
+        return false;
+      }
+    }
+    std::lock_guard<std::mutex> lock(mutex);
+    if(state == status::cancelled) {
+      return false;
+    }
+    if(static_cast<Derived*>(this)->try_complete()) {
+      state = status::granted;
+      return false;
+    }
+    state = status::queued;
+    queue.push_back(*this);
+    return true;
+  }
+
+  static void cancel(void* self) {
+    auto waiter = static_cast<sync_awaiter*>(self);
+    std::lock_guard<std::mutex> lock(waiter->mutex);
+    if(waiter->state == status::idle) {
+      // await_suspend() has not queued it yet, and will not
+      waiter->state = status::cancelled;
+    } else if(waiter->state == status::queued) {
+      waiter->queue.erase(*waiter);
+      wake(*waiter, status::cancelled);
+    }
+  }
+
+  /** @brief Called first by Derived::await_resume().
+   *  @throw operation_cancelled if the wait is cancelled.
+   */
+  void finish_wait() {
+    if(token) {
+      token.deregister_callback(callback);
+    }
+    if(state == status::cancelled) {
+      throw operation_cancelled{};
+    }
+  }
+};
+
+/** @brief A manual-reset event: co_await event.wait() suspends until set() is called,
+ *         which resumes every waiter. Waiting on a set event does not suspend.
+ */
+struct async_event {
+  std::mutex mutex;
+  waiter_queue waiters;
+  std::atomic<bool> flag;
+
+  explicit async_event(bool set = false):
+    mutex(), waiters(), flag(set)
+  {}
+
+  async_event(const async_event&) = delete;
+  void operator=(const async_event&) = delete;
+
+  struct awaiter: public sync_awaiter<awaiter> {
+    async_event& event;
+
+    explicit awaiter(async_event& event):
+      sync_awaiter<awaiter>(event.mutex, event.waiters), event(event)
+    {}
+
+    bool await_ready() const noexcept {
+      return event.is_set();
+    }
+
+    bool try_complete() noexcept {
+      return event.flag.load(std::memory_order_relaxed);
+    }
+
+    void await_resume() {
+      finish_wait();
+    }
+  };
+
+  awaiter wait() {
+    return awaiter(*this);
+  }
+
+  bool is_set() const noexcept {
+    return flag.load(std::memory_order_acquire);
+  }
+
+  void set() {
+    std::lock_guard<std::mutex> lock(mutex);
+    flag.store(true, std::memory_order_release);
+    while(auto waiter = waiters.pop_front()) {
+      wake(*waiter);
+    }
+  }
+
+  void reset() noexcept {
+    flag.store(false, std::memory_order_release);
+  }
+};
+
+struct async_mutex;
+
+/** @brief Unlocks an async_mutex when destroyed.
+ */
+struct async_lock_guard {
+  async_mutex* owner;
+
+  explicit async_lock_guard(async_mutex& owner):
+    owner(&owner)
+  {}
+
+  async_lock_guard(const async_lock_guard&) = delete;
+  void operator=(const async_lock_guard&) = delete;
+
+  async_lock_guard(async_lock_guard&& rhs) noexcept:
+    owner(std::exchange(rhs.owner, nullptr))
+  {}
+
+  inline ~async_lock_guard();
+};
+
+/** @brief A mutex whose lock() suspends the coroutine instead of blocking the thread.
+ *         unlock() hands the lock directly to the longest waiter, so newcomers cannot barge in.
+ */
+struct async_mutex {
+  std::mutex mutex;
+  waiter_queue waiters;
+  bool locked;
+
+  async_mutex():
+    mutex(), waiters(), locked(false)
+  {}
+
+  async_mutex(const async_mutex&) = delete;
+  void operator=(const async_mutex&) = delete;
+
+  struct lock_awaiter: public sync_awaiter<lock_awaiter> {
+    async_mutex& owner;
+
+    explicit lock_awaiter(async_mutex& owner):
+      sync_awaiter<lock_awaiter>(owner.mutex, owner.waiters), owner(owner)
+    {}
+
+    bool try_complete() noexcept {
+      return !std::exchange(owner.locked, true);
+    }
+
+    void await_resume() {
+      finish_wait();
+    }
+  };
+
+  struct scoped_lock_awaiter: public lock_awaiter {
+    using lock_awaiter::lock_awaiter;
+
+    async_lock_guard await_resume() {
+      finish_wait();
+      return async_lock_guard(owner);
+    }
+  };
+
+  /** @brief co_await mutex.lock(). Call unlock() when done.
+   */
+  lock_awaiter lock() {
+    return lock_awaiter(*this);
+  }
+
+  /** @brief auto guard = co_await mutex.scoped_lock() unlocks when the guard goes out of scope.
+   */
+  scoped_lock_awaiter scoped_lock() {
+    return scoped_lock_awaiter(*this);
+  }
+
+  bool try_lock() {
+    std::lock_guard<std::mutex> lock(mutex);
+    return !std::exchange(locked, true);
+  }
+
+  void unlock() {
+    std::lock_guard<std::mutex> lock(mutex);
+    if(auto waiter = waiters.pop_front()) {
+      // Stays locked on behalf of the waiter
+      wake(*waiter);
+    } else {
+      locked = false;
+    }
+  }
+};
+
+async_lock_guard::~async_lock_guard() {
+  if(owner) {
+    owner->unlock();
+  }
+}
+
+/** @brief A counting semaphore, e.g. to limit the number of requests in flight.
+ *         release() hands the units to the waiters in FIFO order before making them available.
+ */
+struct async_semaphore {
+  std::mutex mutex;
+  waiter_queue waiters;
+  size_t count;
+
+  explicit async_semaphore(size_t count):
+    mutex(), waiters(), count(count)
+  {}
+
+  async_semaphore(const async_semaphore&) = delete;
+  void operator=(const async_semaphore&) = delete;
+
+  struct awaiter: public sync_awaiter<awaiter> {
+    async_semaphore& owner;
+
+    explicit awaiter(async_semaphore& owner):
+      sync_awaiter<awaiter>(owner.mutex, owner.waiters), owner(owner)
+    {}
+
+    bool try_complete() noexcept {
+      if(owner.count == 0) {
+        return false;
+      }
+      owner.count --;
+      return true;
+    }
+
+    void await_resume() {
+      finish_wait();
+    }
+  };
+
+  /** @brief co_await semaphore.acquire() takes one unit, suspending until one is released.
+   */
+  awaiter acquire() {
+    return awaiter(*this);
+  }
+
+  bool try_acquire() {
+    std::lock_guard<std::mutex> lock(mutex);
+    if(count == 0) {
+      return false;
+    }
+    count --;
+    return true;
+  }
+
+  void release(size_t units = 1) {
+    std::lock_guard<std::mutex> lock(mutex);
+    for(; units > 0; units --) {
+      auto waiter = waiters.pop_front();
+      if(!waiter) {
+        break;
+      }
+      wake(*waiter);
+    }
+    count += units;
+  }
+
+  size_t available() {
+    std::lock_guard<std::mutex> lock(mutex);
+    return count;
+  }
+};
+
+} // namespace asyncio
@@ -0,0 +1,270 @@
+#pragma once
+
+#include <atomic>
+#include <exception>
+#include <iostream>
+#include <memory>
+#include <optional>
+#include <utility>
+#include "common.hpp"
+#include "trace.hpp"
+#include "frame_allocator.hpp"
+#include "cancellation.hpp"
+#include "coroutine.hpp"
+
+namespace asyncio {
+
+struct task_group;
+
+/** @brief A coroutine nobody owns. It starts when its handle is first resumed or scheduled,
+ *         and its frame frees itself when it finishes, so the engine keeps no record of it.
+ *         It runs a task in the background by awaiting it: the task object lives in its frame.
+ */
+struct detached_task {
+  struct promise_type: public pooled_frame {
+    abstract_engine* engine_ptr;
+    // Inherited by the task it awaits
+    cancellation_token token;
+    std::optional<priority> prio;
+    // Notified once the frame is destroyed, if it runs in a group
+    task_group* group;
+    uint64_t promise_id;
+
+    promise_type():
+      engine_ptr(nullptr), token(), prio(), group(nullptr), promise_id(generate_id())
+    {}
+
+    detached_task get_return_object() {
+      return detached_task{coroutine_handle<promise_type>::from_promise(*this)};
+    }
+
+    auto initial_suspend() {
+      return suspend_always();
+    }
+
+    struct final_awaiter {
+      constexpr bool await_ready() const noexcept {
+        return false;
+      }
+
+      coroutine_handle<> await_suspend(coroutine_handle<promise_type> self) noexcept;
+
+      constexpr void await_resume() const noexcept {}
+    };
+
+    final_awaiter final_suspend() noexcept {
+      ASYNCIO_TRACE("detached task ", promise_id, " finished");
+      return final_awaiter{};
+    }
+
+    void return_void() {}
+
+    /** @brief Like a task nobody awaits: the exception propagates out of the engine, unless it is a cancellation.
+     */
+    void unhandled_exception() {
+      try {
+        throw;
+      } catch(const operation_cancelled&) {
+        ASYNCIO_TRACE("detached task ", promise_id, " is cancelled");
+      }
+    }
+  };
+
+  coroutine_handle<promise_type> handle;
+};
+
+/** @brief Suspends until a task finishes, without starting it.
+ */
+struct completion_awaiter {
+  task_state& state;
+  continuation node;
+
+  explicit completion_awaiter(task_state& state):
+    state(state), node()
+  {}
+
+  bool await_ready() const noexcept {
+    return state.is_done();
+  }
+
+  bool await_suspend(coroutine_handle<> caller) noexcept {
+    node.handle = caller;
+    // Not registered if the task has finished in the meantime
+    return state.add_awaiter(node);
+  }
+
+  constexpr void await_resume() const noexcept {}
+};
+
+template<typename T>
+detached_task run_detached(task<T> t) {
+  co_await t;
+}
+
+/** @brief Destroys an owned task object once the task finishes. A task that is never started is never freed.
+ */
+inline detached_task release_when_done(std::unique_ptr<abstract_task> owned) {
+  co_await completion_awaiter(owned->get_state());
+}
+
+/** @brief Runs a task in the background on engine, fire-and-forget.
+ *         Both the task frame and the detached frame that awaits it free themselves when it finishes,
+ *         so a finished task costs nothing afterwards.
+ *         Like schedule(), it must be called on the engine thread unless the engine allows otherwise.
+ */
+template<typename T>
+void spawn(abstract_engine& engine, task<T>&& t) {
+  auto prio = t.handle.promise().prio;
+  auto detached = run_detached(std::move(t));
+  detached.handle.promise().engine_ptr = &engine;
+  detached.handle.promise().prio = prio;
+  engine.schedule(detached.handle, asap, prio.value_or(priority::normal));
+}
+
+/** @brief A nursery: the tasks spawned into it run detached under the group's cancellation token,
+ *         and co_await group.join() resumes once all of them are done.
+ *         The first exception other than a cancellation cancels the remaining tasks and is rethrown by join().
+ *         Cancelling the coroutine waiting in join() cancels the group as well.
+ *  @pre The group is joined before it is destroyed.
+ */
+struct task_group {
+  abstract_engine* engine_ptr;
+  cancellation_source source;
+  // The running tasks, plus one reference dropped by join() when it suspends
+  std::atomic<size_t> remaining;
+  coroutine_handle<> waiter;
+  std::atomic<bool> failed;
+  // Written by the first failing task before it leaves the group
+  std::exception_ptr error;
+
+  explicit task_group(abstract_engine& engine):
+    engine_ptr(&engine), source(), remaining(1), waiter(), failed(false), error()
+  {}
+
+  task_group(const task_group&) = delete;
+  void operator=(const task_group&) = delete;
+
+  ~task_group() {
+    if(remaining.load(std::memory_order_acquire) != 1) {
+      std::cerr << "task_group destroyed with running tasks" << std::endl;
+      std::terminate();
+    }
+  }
+
+  template<typename T>
+  static detached_task run_member(task_group& group, task<T> t) {
+    try {
+      co_await t;
+    } catch(const operation_cancelled&) {
+      ASYNCIO_TRACE("task ", t.promise_id, " in a group is cancelled");
+    } catch(...) {
+      group.fail(std::current_exception());
+    }
+  }
+
+  /** @brief Runs a task in the group. It can be called from the tasks of the group as well.
+   */
+  template<typename T>
+  void spawn(task<T>&& t) {
+    remaining.fetch_add(1, std::memory_order_relaxed);
+    auto prio = t.handle.promise().prio;
+    auto member = run_member(*this, std::move(t));
+    auto& promise = member.handle.promise();
+    promise.engine_ptr = engine_ptr;
+    promise.token = source.token();
+    promise.prio = prio;
+    promise.group = this;
+    engine_ptr->schedule(member.handle, asap, prio.value_or(priority::normal));
+  }
+
+  size_t size() const noexcept {
+    return remaining.load(std::memory_order_relaxed) - 1;
+  }
+
+  cancellation_token token() const {
+    return source.token();
+  }
+
+  void cancel() {
+    source.request_cancellation();
+  }
+
+  void fail(std::exception_ptr e) {
+    if(!failed.exchange(true, std::memory_order_acq_rel)) {
+      error = std::move(e);
+      cancel();
+    }
+  }
+
+  /** @brief Called by a member after its frame is destroyed.
+   *  @return The waiter in join() if this was the last task, or noop_coroutine().
+   */
+  coroutine_handle<> leave() noexcept {
+    if(remaining.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+      return waiter;
+    }
+    return noop_coroutine();
+  }
+
+  struct join_awaiter {
+    task_group& group;
+    cancellation_token parent_token;
+    // Forwards a cancellation of the waiter to the group
+    cancellation_callback forward;
+
+    constexpr bool await_ready() const noexcept {
+      return false;
+    }
+
+    template<typename P>
+    bool await_suspend(coroutine_handle<P> caller) {
+      group.waiter = caller;
+      parent_token = token_of(caller);
+      if(parent_token) {
+        forward.fn = [](void* self) {
+          static_cast<task_group*>(self)->cancel();
+        };
+        forward.context = &group;
+        if(!parent_token.register_callback(forward)) {
+          group.cancel();
+        }
+      }
+      return group.remaining.fetch_sub(1, std::memory_order_acq_rel) != 1;
+    }
+
+    /** @brief Leaves the group empty and ready for reuse, with a fresh token if it was cancelled.
+     */
+    void await_resume() {
+      if(parent_token) {
+        parent_token.deregister_callback(forward);
+      }
+      group.remaining.store(1, std::memory_order_relaxed);
+      group.failed.store(false, std::memory_order_relaxed);
+      if(group.source.is_cancellation_requested()) {
+        group.source = cancellation_source();
+      }
+      if(auto e = std::exchange(group.error, nullptr)) {
+        std::rethrow_exception(e);
+      }
+      if(parent_token) {
+        parent_token.throw_if_cancellation_requested();
+      }
+    }
+  };
+
+  /** @brief co_await group.join() waits for every task in the group.
+   *  @pre Only one coroutine joins at a time.
+   */
+  join_awaiter join() {
+    return join_awaiter{*this, cancellation_token{}, cancellation_callback{}};
+  }
+};
+
+inline coroutine_handle<> detached_task::promise_type::final_awaiter::await_suspend(
+  coroutine_handle<promise_type> self) noexcept {
+  auto group = self.promise().group;
+  self.destroy();
+  return group ? group->leave() : noop_coroutine();
+}
+
+} // namespace asyncio
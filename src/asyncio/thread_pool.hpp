@@ -0,0 +1,168 @@
+#pragma once
+
+#include "common.hpp"
+#include "coroutine.hpp"
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <mutex>
+#include <optional>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+namespace asyncio {
+
+/** @brief A fixed number of worker threads for blocking or CPU-heavy work.
+ *         Jobs are run in FIFO order. Destroying the pool finishes the queued jobs first.
+ */
+struct thread_pool {
+  struct stats_type {
+    uint64_t submitted = 0;
+    uint64_t completed = 0;
+    size_t queue_depth = 0;
+    size_t max_queue_depth = 0;
+  };
+
+  std::mutex mutex;
+  std::condition_variable cv;
+  std::deque<std::function<void()>> jobs;
+  std::vector<std::thread> threads;
+  bool stopping;
+  stats_type counters;  // Protected by mutex
+
+  explicit thread_pool(size_t thread_count = std::thread::hardware_concurrency()):
+    mutex(), cv(), jobs(), threads(), stopping(false), counters()
+  {
+    thread_count = std::max<size_t>(thread_count, 1);
+    for(size_t i = 0; i < thread_count; i ++) {
+      threads.emplace_back([this] { work(); });
+    }
+  }
+
+  thread_pool(const thread_pool&) = delete;
+  void operator=(const thread_pool&) = delete;
+
+  ~thread_pool() {
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      stopping = true;
+    }
+    cv.notify_all();
+    for(auto& t: threads) {
+      t.join();
+    }
+  }
+
+  size_t thread_count() const noexcept {
+    return threads.size();
+  }
+
+  /** @brief Safe to call from any thread.
+   */
+  void submit(std::function<void()> job) {
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      jobs.push_back(std::move(job));
+      counters.submitted ++;
+      counters.max_queue_depth = std::max(counters.max_queue_depth, jobs.size());
+    }
+    cv.notify_one();
+  }
+
+  /** @brief A snapshot of the counters. queue_depth counts jobs not picked up by a worker yet.
+   */
+  stats_type stats() {
+    std::lock_guard<std::mutex> lock(mutex);
+    auto ret = counters;
+    ret.queue_depth = jobs.size();
+    return ret;
+  }
+
+private:
+  void work() {
+    std::unique_lock<std::mutex> lock(mutex);
+    while(true) {
+      cv.wait(lock, [this] { return stopping || !jobs.empty(); });
+      if(jobs.empty()) {
+        return;
+      }
+      auto job = std::move(jobs.front());
+      jobs.pop_front();
+      lock.unlock();
+      job();
+      lock.lock();
+      counters.completed ++;
+    }
+  }
+};
+
+/** @brief Runs a callable on a thread_pool and resumes the awaiting task on its engine
+ *         with the result, or rethrows the exception the callable threw.
+ */
+template<typename Fn>
+struct pool_awaiter {
+  using result_type = std::invoke_result_t<Fn&>;
+  using storage_type = std::conditional_t<std::is_void_v<result_type>, bool, result_type>;
+
+  thread_pool& pool;
+  Fn fn;
+  std::optional<storage_type> result;
+  std::exception_ptr error;
+
+  pool_awaiter(thread_pool& pool, Fn fn):
+    pool(pool), fn(std::move(fn)), result(), error()
+  {}
+
+  constexpr bool await_ready() const noexcept {
+    return false;
+  }
+
+  template<typename P>
+  void await_suspend(coroutine_handle<P> caller) {
+    auto engine = caller.promise().engine_ptr;
+    if(!engine) {
+      throw no_engine{};
+    }
+    // Resumed in its own class
+    auto prio = priority_of(caller);
+    // Keeps run() waiting while the job is away from the engine
+    engine->add_work();
+    pool.submit([this, engine, caller, prio]() {
+      try {
+        if constexpr(std::is_void_v<result_type>) {
+          fn();
+          result = true;
+        } else {
+          result = fn();
+        }
+      } catch(...) {
+        error = std::current_exception();
+      }
+      // This awaiter may be destroyed once the caller is posted, so only locals are used after it
+      engine->post(caller, prio);
+      engine->remove_work();
+    });
+  }
+
+  result_type await_resume() {
+    if(error) {
+      std::rethrow_exception(error);
+    }
+    if constexpr(!std::is_void_v<result_type>) {
+      return std::move(result.value());
+    }
+  }
+};
+
+/** @brief co_await run_in_pool(pool, fn) inside a task runs fn() on pool without blocking the engine.
+ */
+template<typename Fn>
+pool_awaiter<std::decay_t<Fn>> run_in_pool(thread_pool& pool, Fn&& fn) {
+  return pool_awaiter<std::decay_t<Fn>>(pool, std::forward<Fn>(fn));
+}
+
+} // namespace asyncio
@@ -0,0 +1,158 @@
+#pragma once
+
+#include "common.hpp"
+#include "utils.hpp"
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <utility>
+#include <vector>
+
+namespace asyncio {
+
+/** @brief A timer that can be removed from an engine before it is due.
+ *         It lives in the awaiter, and the heap keeps its position up to date, so removal is O(log n)
+ *         without any allocation or search.
+ */
+struct timer_entry {
+  static constexpr size_t not_queued = std::numeric_limits<size_t>::max();
+
+  time_point awake_at{};
+  coroutine_handle<> handle{};
+  priority prio = priority::normal;
+  // Position in the timer_heap, or not_queued
+  size_t heap_index = not_queued;
+  // Set by a cancellation that comes before the timer is queued, so that it is resumed at once
+  bool cancelled = false;
+};
+
+/** @brief Binary min-heap of pending wakeups, shared by the engines.
+ *         seq breaks ties between events with the same deadline, so that
+ *         they are resumed in the order they are scheduled.
+ */
+struct timer_heap {
+  struct event_data {
+    time_point awake_at;
+    uint64_t seq;
+    coroutine_handle<> handle;
+    // Non-null for cancellable timers
+    timer_entry* entry;
+    priority prio;
+  };
+
+  std::vector<event_data> events;
+  uint64_t next_seq;
+
+  timer_heap():
+    events(), next_seq(0)
+  {}
+
+  bool empty() const noexcept {
+    return events.empty();
+  }
+
+  size_t size() const noexcept {
+    return events.size();
+  }
+
+  const event_data& top() const noexcept {
+    return events.front();
+  }
+
+  void push(time_point awake_at, coroutine_handle<> handle, timer_entry* entry = nullptr,
+            priority prio = priority::normal) {
+    events.push_back(event_data{awake_at, next_seq ++, handle, entry, prio});
+    sift_up(events.size() - 1);
+  }
+
+  void push(timer_entry& entry) {
+    push(entry.awake_at, entry.handle, &entry, entry.prio);
+  }
+
+  /** @brief Removes the earliest event.
+   *  @return Its handle.
+   */
+  coroutine_handle<> pop() noexcept {
+    auto handle = events.front().handle;
+    remove_at(0);
+    return handle;
+  }
+
+  /** @brief Removes a cancellable timer if it is queued.
+   *  @return Whether it was queued.
+   */
+  bool erase(timer_entry& entry) noexcept {
+    if(entry.heap_index == timer_entry::not_queued) {
+      return false;
+    }
+    remove_at(entry.heap_index);
+    return true;
+  }
+
+private:
+  static bool earlier(const event_data& lhs, const event_data& rhs) noexcept {
+    if(lhs.awake_at != rhs.awake_at) {
+      return lhs.awake_at < rhs.awake_at;
+    }
+    return lhs.seq < rhs.seq;
+  }
+
+  void place(size_t index, event_data&& ev) noexcept {
+    if(ev.entry) {
+      ev.entry->heap_index = index;
+    }
+    events[index] = std::move(ev);
+  }
+
+  void remove_at(size_t index) noexcept {
+    if(events[index].entry) {
+      events[index].entry->heap_index = timer_entry::not_queued;
+    }
+    auto last = std::move(events.back());
+    events.pop_back();
+    if(index == events.size()) {
+      return;
+    }
+    place(index, std::move(last));
+    if(index > 0 && earlier(events[index], events[(index - 1) / 2])) {
+      sift_up(index);
+    } else {
+      sift_down(index);
+    }
+  }
+
+  void sift_up(size_t index) noexcept {
+    auto ev = std::move(events[index]);
+    while(index > 0) {
+      auto parent = (index - 1) / 2;
+      if(!earlier(ev, events[parent])) {
+        break;
+      }
+      place(index, std::move(events[parent]));
+      index = parent;
+    }
+    place(index, std::move(ev));
+  }
+
+  void sift_down(size_t index) noexcept {
+    auto ev = std::move(events[index]);
+    auto n = events.size();
+    while(true) {
+      auto child = index * 2 + 1;
+      if(child >= n) {
+        break;
+      }
+      if(child + 1 < n && earlier(events[child + 1], events[child])) {
+        child ++;
+      }
+      if(!earlier(events[child], ev)) {
+        break;
+      }
+      place(index, std::move(events[child]));
+      index = child;
+    }
+    place(index, std::move(ev));
+  }
+};
+
+} // namespace asyncio
@@ -0,0 +1,26 @@
+#include "trace.hpp"
+#include <atomic>
+#include <cstdio>
+
+namespace asyncio {
+
+namespace {
+
+std::atomic<trace_sink> current_sink{&stdout_trace_sink};
+
+} // namespace
+
+void stdout_trace_sink(std::string_view line) {
+  std::fwrite(line.data(), 1, line.size(), stdout);
+  std::fputc('\n', stdout);
+}
+
+trace_sink set_trace_sink(trace_sink sink) {
+  return current_sink.exchange(sink ? sink : &stdout_trace_sink);
+}
+
+trace_sink get_trace_sink() {
+  return current_sink.load(std::memory_order_relaxed);
+}
+
+} // namespace asyncio
@@ -0,0 +1,61 @@
+#pragma once
+
+#include "ndn-cpp-cocomo-config.hpp"
+#include <memory>
+#include <ostream>
+#include <sstream>
+#include <string_view>
+
+namespace asyncio {
+
+/** @brief Whether coroutine transitions are traced.
+ *         Enabled by `./waf configure --with-trace`. When disabled, ASYNCIO_TRACE compiles to nothing
+ *         and its arguments are never evaluated.
+ */
+#ifdef NDN_CPP_COCOMO_WITH_TRACE
+constexpr bool trace_enabled = true;
+#else
+constexpr bool trace_enabled = false;
+#endif
+
+/** @brief Receives one formatted line per traced event, without the trailing newline.
+ */
+using trace_sink = void(*)(std::string_view line);
+
+/** @brief The default sink, which writes each line to stdout without flushing.
+ */
+void stdout_trace_sink(std::string_view line);
+
+/** @brief Replaces the sink of the whole process.
+ *  @return The previous sink.
+ */
+trace_sink set_trace_sink(trace_sink sink);
+
+trace_sink get_trace_sink();
+
+/** @brief Writes arg to os, or its address if it has no operator<<, e.g. a yielded user type.
+ */
+template<typename Arg>
+void trace_arg(std::ostream& os, const Arg& arg) {
+  if constexpr(requires(std::ostream& o, const Arg& a) { o << a; }) {
+    os << arg;
+  } else {
+    os << "<object at " << static_cast<const void*>(std::addressof(arg)) << ">";
+  }
+}
+
+template<typename... Args>
+void trace(const Args&... args) {
+  std::ostringstream os;
+  (trace_arg(os, args), ...);
+  get_trace_sink()(os.view());
+}
+
+} // namespace asyncio
+
+#define ASYNCIO_TRACE(...) \
+  do { \
+    if constexpr(::asyncio::trace_enabled) { \
+      ::asyncio::trace(__VA_ARGS__); \
+    } \
+  } while(false)
@@ -1,28 +1,107 @@
 #pragma once
 
+#include <array>
+#include <bit>
 #include <functional>
 #include <cstdint>
 #include <chrono>
 #include <thread>
+#include <cerrno>
+#include <time.h>
+#include <algorithm>
 
 namespace asyncio {
 
-using msec = uint64_t;
+using duration = std::chrono::nanoseconds;
+using time_point = std::chrono::time_point<std::chrono::steady_clock, duration>;
+
+/** @brief A deadline that is always due: schedule(handle, asap) resumes handle in the current round.
+ */
+constexpr time_point asap{};
+
+/** @brief Scheduling class of a coroutine. Among the coroutines that are due, the engine resumes higher classes
+ *         first, e.g. keep-alives and routing updates before bulk data. A task inherits the class of its first awaiter.
+ */
+enum class priority: uint8_t {
+  high,
+  normal,
+  low,
+};
+
+constexpr size_t priority_count = 3;
+
+/** @brief Histogram of latencies in power-of-two buckets of nanoseconds.
+ */
+struct latency_stats {
+  uint64_t count = 0;
+  duration total{};
+  duration max{};
+  // buckets[i] counts the latencies below 2^i ns and not below 2^(i-1) ns
+  std::array<uint64_t, 64> buckets{};
+
+  void record(duration latency) noexcept {
+    auto ns = static_cast<uint64_t>(std::max<duration::rep>(latency.count(), 0));
+    count ++;
+    total += duration(ns);
+    max = std::max(max, duration(ns));
+    buckets[std::min<size_t>(std::bit_width(ns), buckets.size() - 1)] ++;
+  }
+
+  duration mean() const noexcept {
+    return count ? total / static_cast<duration::rep>(count) : duration::zero();
+  }
+
+  /** @return An upper bound of the given percentile (0 to 100), within a factor of two.
+   */
+  duration percentile(double p) const noexcept {
+    auto rank = static_cast<uint64_t>(p / 100 * count);
+    uint64_t seen = 0;
+    for(size_t i = 0; i < buckets.size(); i ++) {
+      seen += buckets[i];
+      if(seen > rank) {
+        return std::min(max, duration(i == 0 ? 0 : (duration::rep(1) << std::min<size_t>(i, 62))));
+      }
+    }
+    return max;
+  }
+};
 
 struct timer {
   virtual ~timer(){}
 
-  virtual msec now() {
-    return static_cast<uint64_t>(
-      std::chrono::duration_cast<std::chrono::milliseconds>(
-        std::chrono::steady_clock::now().time_since_epoch()).count());
+  virtual time_point now() {
+    return std::chrono::steady_clock::now();
   }
 
-  virtual void sleep(msec tim) {
-    std::this_thread::sleep_for(std::chrono::milliseconds(tim));
+  /** @brief Sleeps until an absolute deadline, so that the time spent before the call does not add up.
+   */
+  virtual void sleep_until(time_point deadline) {
+#if defined(__linux__)
+    // steady_clock is CLOCK_MONOTONIC on Linux
+    auto ns = deadline.time_since_epoch().count();
+    timespec ts{static_cast<time_t>(ns / 1000000000), static_cast<long>(ns % 1000000000)};
+    while(::clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, nullptr) == EINTR) {
+    }
+#else
+    std::this_thread::sleep_until(deadline);
+#endif
+  }
+
+  virtual void sleep(duration tim) {
+    sleep_until(now() + tim);
   }
 };
 
+/** @brief Hints the CPU that the thread is spinning.
+ */
+inline void cpu_relax() noexcept {
+#if defined(__x86_64__) || defined(__i386__)
+  __builtin_ia32_pause();
+#elif defined(__aarch64__)
+  asm volatile("yield");
+#endif
+}
+
 uint64_t generate_id();
 
 } // namespace asyncio
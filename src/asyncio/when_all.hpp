@@ -0,0 +1,342 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <limits>
+#include <ranges>
+#include <span>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+#include <variant>
+#include <vector>
+#include "common.hpp"
+#include "cancellation.hpp"
+#include "coroutine.hpp"
+
+namespace asyncio {
+
+/** @brief Combinators that await several tasks at once:
+ *         co_await when_all(a, b), co_await when_all(tasks) and co_await when_any(a, b).
+ *         The children are started inline by the awaiting coroutine, which is resumed exactly once
+ *         when they are done. The continuation nodes live in the awaiter, like the one of a plain co_await,
+ *         so the variadic forms do not allocate. The tasks are taken by reference and must outlive the co_await;
+ *         their results stay in them.
+ */
+struct join_counter;
+
+/** @brief A continuation of one child, which notifies the combinator instead of resuming a coroutine.
+ */
+struct join_node: public continuation {
+  join_counter* owner;
+  size_t index;
+};
+
+/** @brief Counts the children still running. The count starts one above the number of children and
+ *         await_suspend() releases the extra reference after starting all of them, so a child finishing
+ *         inline can never resume the parent while it is still suspending.
+ */
+struct join_counter {
+  std::atomic<size_t> remaining;
+  coroutine_handle<> parent;
+  abstract_engine* engine_ptr;
+  // Passed to the children started here
+  cancellation_token token;
+  priority prio;
+
+  join_counter():
+    remaining(0), parent(), engine_ptr(nullptr), token(), prio(priority::normal)
+  {}
+
+  join_counter(const join_counter&) = delete;
+  void operator=(const join_counter&) = delete;
+
+  /** @return Whether the caller dropped the last reference, and so must resume the parent.
+   */
+  bool release() noexcept {
+    return remaining.fetch_sub(1, std::memory_order_acq_rel) == 1;
+  }
+
+  static coroutine_handle<> notify_release(continuation& node) {
+    auto owner = static_cast<join_node&>(node).owner;
+    // The awaiter may be gone as soon as another child drops the last reference
+    return owner->release() ? owner->parent : nullptr;
+  }
+
+  template<typename P>
+  void prepare(coroutine_handle<P> caller, size_t count) {
+    parent = caller;
+    engine_ptr = caller.promise().engine_ptr;
+    if(!engine_ptr) {
+      throw no_engine{};
+    }
+    prio = priority_of(caller);
+    remaining.store(count + 1, std::memory_order_relaxed);
+  }
+
+  /** @brief Registers node on child, running the child inline until its first suspension if nobody runs it yet.
+   */
+  template<typename T>
+  void start(task<T>& child, join_node& node, size_t index, coroutine_handle<> (*notify)(continuation&)) {
+    node.handle = parent;
+    node.next = nullptr;
+    node.notify = notify;
+    node.owner = this;
+    node.index = index;
+    // A child that is already done is notified at once, so that when_any() sees it.
+    // The reference held by await_suspend() keeps the notification from returning the parent.
+    if(child.state.is_done()) {
+      notify(node);
+      return;
+    }
+    coroutine_handle<> self = child.handle;
+    auto next = base_task_promise::await_task(self, child.handle.promise(), child.state, node, engine_ptr,
+                                              cancellation_token(token), prio);
+    if(next == self) {
+      self.resume();
+    } else if(next == parent) {
+      // Finished in the meantime, so the node is not registered
+      notify(node);
+    }
+  }
+};
+
+template<typename T>
+using when_all_value_t = std::conditional_t<std::is_void_v<T>, std::monostate, T>;
+
+template<typename T>
+when_all_value_t<T> take_result(task<T>& child) {
+  if constexpr(std::is_void_v<T>) {
+    child.result();
+    return std::monostate{};
+  } else {
+    return child.result();
+  }
+}
+
+template<typename... T>
+struct when_all_awaiter: public join_counter {
+  std::tuple<task<T>&...> children;
+  std::array<join_node, sizeof...(T)> nodes;
+
+  explicit when_all_awaiter(task<T>&... children):
+    join_counter(), children(children...), nodes()
+  {}
+
+  bool await_ready() const noexcept {
+    return std::apply([](auto&... child) {
+      return (child.state.is_done() && ...);
+    }, children);
+  }
+
+  template<typename P>
+  bool await_suspend(coroutine_handle<P> caller) {
+    token = token_of(caller);
+    prepare(caller, sizeof...(T));
+    [this]<size_t... I>(std::index_sequence<I...>) {
+      (start(std::get<I>(children), nodes[I], I, &join_counter::notify_release), ...);
+    }(std::index_sequence_for<T...>{});
+    return !release();
+  }
+
+  /** @return The results in argument order, with std::monostate for task<void>.
+   *          If some children failed, the exception of the first one in argument order is rethrown.
+   */
+  std::tuple<when_all_value_t<T>...> await_resume() {
+    return std::apply([](auto&... child) {
+      // A braced list is evaluated left to right
+      return std::tuple<when_all_value_t<T>...>{take_result(child)...};
+    }, children);
+  }
+};
+
+/** @brief when_all() over a contiguous range of task<T>. The nodes are allocated once, in one block.
+ */
+template<typename T>
+struct when_all_range_awaiter: public join_counter {
+  std::span<task<T>> children;
+  std::vector<join_node> nodes;
+
+  explicit when_all_range_awaiter(std::span<task<T>> children):
+    join_counter(), children(children), nodes()
+  {}
+
+  bool await_ready() const noexcept {
+    for(auto& child: children) {
+      if(!child.state.is_done()) {
+        return false;
+      }
+    }
+    return true;
+  }
+
+  template<typename P>
+  bool await_suspend(coroutine_handle<P> caller) {
+    token = token_of(caller);
+    prepare(caller, children.size());
+    nodes.resize(children.size());
+    for(size_t i = 0; i < children.size(); i ++) {
+      start(children[i], nodes[i], i, &join_counter::notify_release);
+    }
+    return !release();
+  }
+
+  /** @return The results in the order of the range, or nothing for task<void>.
+   *          If some children failed, the exception of the first one is rethrown.
+   */
+  auto await_resume() {
+    if constexpr(std::is_void_v<T>) {
+      for(auto& child: children) {
+        child.result();
+      }
+    } else {
+      std::vector<T> results;
+      results.reserve(children.size());
+      for(auto& child: children) {
+        results.push_back(child.result());
+      }
+      return results;
+    }
+  }
+};
+
+/** @brief Shared part of when_any(). The first child to finish cancels the others through a
+ *         cancellation_source of the combinator, which also follows the token of the parent.
+ *         The parent is resumed once every child is done, so no child outlives the co_await, but
+ *         a child only stops early at its cancellation points (e.g. a sleep). The source is allocated
+ *         once per co_await.
+ */
+struct when_any_counter: public join_counter {
+  static constexpr size_t no_winner = std::numeric_limits<size_t>::max();
+
+  std::atomic<size_t> winner;
+  cancellation_source source;
+  cancellation_token parent_token;
+  // Forwards a cancellation of the parent to the children
+  cancellation_callback forward;
+
+  when_any_counter():
+    join_counter(), winner(no_winner), source(), parent_token(), forward()
+  {}
+
+  static coroutine_handle<> notify_first(continuation& node) {
+    auto& self = static_cast<join_node&>(node);
+    auto owner = static_cast<when_any_counter*>(self.owner);
+    size_t expected = no_winner;
+    if(owner->winner.compare_exchange_strong(expected, self.index, std::memory_order_acq_rel)) {
+      owner->source.request_cancellation();
+    }
+    return notify_release(node);
+  }
+
+  template<typename P>
+  void prepare(coroutine_handle<P> caller, size_t count) {
+    join_counter::prepare(caller, count);
+    token = source.token();
+    parent_token = token_of(caller);
+    if(parent_token) {
+      forward.fn = [](void* self) {
+        static_cast<when_any_counter*>(self)->source.request_cancellation();
+      };
+      forward.context = this;
+      if(!parent_token.register_callback(forward)) {
+        source.request_cancellation();
+      }
+    }
+  }
+
+  /** @return The index of the first child to finish. Its result is taken with result() on the task.
+   *  @throw operation_cancelled if the parent is cancelled.
+   */
+  size_t await_resume() {
+    if(parent_token) {
+      parent_token.deregister_callback(forward);
+      parent_token.throw_if_cancellation_requested();
+    }
+    return winner.load(std::memory_order_acquire);
+  }
+};
+
+template<typename... T>
+struct when_any_awaiter: public when_any_counter {
+  std::tuple<task<T>&...> children;
+  std::array<join_node, sizeof...(T)> nodes;
+
+  explicit when_any_awaiter(task<T>&... children):
+    when_any_counter(), children(children...), nodes()
+  {}
+
+  constexpr bool await_ready() const noexcept {
+    return false;
+  }
+
+  template<typename P>
+  bool await_suspend(coroutine_handle<P> caller) {
+    prepare(caller, sizeof...(T));
+    [this]<size_t... I>(std::index_sequence<I...>) {
+      (start(std::get<I>(children), nodes[I], I, &when_any_counter::notify_first), ...);
+    }(std::index_sequence_for<T...>{});
+    return !release();
+  }
+};
+
+template<typename T>
+struct when_any_range_awaiter: public when_any_counter {
+  std::span<task<T>> children;
+  std::vector<join_node> nodes;
+
+  explicit when_any_range_awaiter(std::span<task<T>> children):
+    when_any_counter(), children(children), nodes()
+  {}
+
+  constexpr bool await_ready() const noexcept {
+    return false;
+  }
+
+  template<typename P>
+  bool await_suspend(coroutine_handle<P> caller) {
+    prepare(caller, children.size());
+    nodes.resize(children.size());
+    for(size_t i = 0; i < children.size(); i ++) {
+      start(children[i], nodes[i], i, &when_any_counter::notify_first);
+    }
+    return !release();
+  }
+};
+
+template<typename Range>
+using range_task_t = std::ranges::range_value_t<Range>;
+
+/** @brief Awaits all the tasks: auto [a, b] = co_await when_all(ta, tb).
+ */
+template<typename... T>
+when_all_awaiter<T...> when_all(task<T>&... tasks) {
+  return when_all_awaiter<T...>(tasks...);
+}
+
+/** @brief Awaits all the tasks of a contiguous range, e.g. a std::vector<task<T>>.
+ */
+template<std::ranges::contiguous_range Range>
+auto when_all(Range& tasks) {
+  return when_all_range_awaiter<typename range_task_t<Range>::value_type>(std::span<range_task_t<Range>>(tasks));
+}
+
+/** @brief Awaits the first of the tasks to finish and cancels the others: size_t i = co_await when_any(ta, tb).
+ *  @pre At least one task.
+ */
+template<typename... T>
+when_any_awaiter<T...> when_any(task<T>&... tasks) {
+  static_assert(sizeof...(T) > 0, "when_any() needs a task");
+  return when_any_awaiter<T...>(tasks...);
+}
+
+/** @brief when_any() over a contiguous range of tasks.
+ *  @pre The range is not empty.
+ */
+template<std::ranges::contiguous_range Range>
+auto when_any(Range& tasks) {
+  return when_any_range_awaiter<typename range_task_t<Range>::value_type>(std::span<range_task_t<Range>>(tasks));
+}
+
+} // namespace asyncio
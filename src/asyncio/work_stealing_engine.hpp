@@ -0,0 +1,263 @@
+#pragma once
+
+#include "common.hpp"
+#include "utils.hpp"
+#include "coroutine.hpp"
+#include "timer_heap.hpp"
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace asyncio {
+
+/** @brief An engine running coroutines on a fixed number of worker threads.
+ *         Each worker owns a deque of ready handles: it pushes and pops at the back, and idle workers steal
+ *         from the front of the others. Timers are kept in one shared heap; the worker that finds a due timer
+ *         moves it to its own deque.
+ *         A coroutine may be resumed on a different thread after every suspension.
+ */
+struct work_stealing_engine: public abstract_engine {
+  struct worker {
+    work_stealing_engine* owner;
+    size_t index;
+    std::mutex mutex;
+    std::deque<coroutine_handle<>> ready;
+  };
+
+  std::vector<std::unique_ptr<worker>> workers;
+  // Protects timers and is used to park idle workers
+  std::mutex timer_mutex;
+  std::condition_variable idle_cv;
+  timer_heap timers;
+  // Handles in all deques
+  std::atomic<size_t> ready_count;
+  // Handles scheduled but not yet returned from resume(), plus add_work() calls not yet matched by
+  // remove_work(); the engine stops when it drops to zero
+  std::atomic<size_t> outstanding;
+  std::atomic<size_t> sleeping;
+  std::atomic<size_t> next_inject;
+  std::atomic<bool> stopped;
+  timer tmer;
+
+  inline static thread_local worker* current_worker = nullptr;
+
+  explicit work_stealing_engine(size_t thread_count = std::thread::hardware_concurrency()):
+    workers(), timer_mutex(), idle_cv(), timers(), ready_count(0), outstanding(0), sleeping(0),
+    next_inject(0), stopped(false), tmer()
+  {
+    thread_count = std::max<size_t>(thread_count, 1);
+    for(size_t i = 0; i < thread_count; i ++) {
+      workers.push_back(std::make_unique<worker>());
+      workers.back()->owner = this;
+      workers.back()->index = i;
+    }
+  }
+
+  size_t thread_count() const noexcept {
+    return workers.size();
+  }
+
+  /** @brief Thread-safe. Handles due now go to the calling worker's deque, or to a worker chosen
+   *         round-robin when called from outside the engine. Priority classes are not implemented:
+   *         every handle goes through the same deques.
+   */
+  void schedule(coroutine_handle<> handle, time_point tim, priority = priority::normal) override {
+    outstanding.fetch_add(1, std::memory_order_relaxed);
+    if(tim <= tmer.now()) {
+      push_ready(handle);
+    } else {
+      {
+        std::lock_guard<std::mutex> lock(timer_mutex);
+        timers.push(tim, handle);
+      }
+      // The new timer may be earlier than what sleeping workers wait for
+      idle_cv.notify_one();
+    }
+  }
+
+  void post(coroutine_handle<> handle, priority prio = priority::normal) override {
+    schedule(handle, asap, prio);
+  }
+
+  /** @brief Thread-safe.
+   */
+  void schedule_timer(timer_entry& entry) override {
+    outstanding.fetch_add(1, std::memory_order_relaxed);
+    bool queued = false;
+    {
+      std::lock_guard<std::mutex> lock(timer_mutex);
+      if(!entry.cancelled && entry.awake_at > tmer.now()) {
+        timers.push(entry);
+        queued = true;
+      }
+    }
+    // Once queued, the entry may be gone as soon as the lock is released
+    if(queued) {
+      idle_cv.notify_one();
+    } else {
+      push_ready(entry.handle);
+    }
+  }
+
+  /** @brief Thread-safe. The timer keeps counting as outstanding work while it moves to a ready deque.
+   */
+  void cancel_timer(timer_entry& entry) override {
+    coroutine_handle<> handle;
+    {
+      std::lock_guard<std::mutex> lock(timer_mutex);
+      if(timers.erase(entry)) {
+        handle = entry.handle;
+      } else {
+        entry.cancelled = true;
+      }
+    }
+    if(handle) {
+      push_ready(handle);
+    }
+  }
+
+  void add_work() noexcept override {
+    outstanding.fetch_add(1, std::memory_order_relaxed);
+  }
+
+  void remove_work() noexcept override {
+    finish_one();
+  }
+
+  template<typename T>
+  void schedule_task(task<T>& task, duration after = duration::zero(), priority prio = priority::normal) {
+    task.set_engine(*this);
+    auto& promise = task.handle.promise();
+    if(!promise.prio) {
+      promise.prio = prio;
+    }
+    promise.schedule_once(task.handle, tmer.now() + after);
+  }
+
+  sleep_awaiter sleep(duration length) {
+    auto awake_at = tmer.now() + length;
+    return sleep_awaiter(this, awake_at);
+  }
+
+  /** @brief Runs until nothing is scheduled, using the calling thread as one of the workers.
+   */
+  void run() {
+    if(outstanding.load(std::memory_order_acquire) == 0) {
+      return;
+    }
+    stopped.store(false, std::memory_order_relaxed);
+    std::vector<std::thread> threads;
+    for(size_t i = 1; i < workers.size(); i ++) {
+      threads.emplace_back([this, i] { work(*workers[i]); });
+    }
+    work(*workers[0]);
+    for(auto& t: threads) {
+      t.join();
+    }
+  }
+
+private:
+  void push_ready(coroutine_handle<> handle) {
+    auto w = current_worker;
+    if(!w || w->owner != this) {
+      w = workers[next_inject.fetch_add(1, std::memory_order_relaxed) % workers.size()].get();
+    }
+    {
+      std::lock_guard<std::mutex> lock(w->mutex);
+      w->ready.push_back(handle);
+    }
+    ready_count.fetch_add(1, std::memory_order_seq_cst);
+    if(sleeping.load(std::memory_order_seq_cst) > 0) {
+      std::lock_guard<std::mutex> lock(timer_mutex);
+      idle_cv.notify_one();
+    }
+  }
+
+  coroutine_handle<> pop_local(worker& self) {
+    std::lock_guard<std::mutex> lock(self.mutex);
+    if(self.ready.empty()) {
+      return nullptr;
+    }
+    auto handle = self.ready.back();
+    self.ready.pop_back();
+    ready_count.fetch_sub(1, std::memory_order_relaxed);
+    return handle;
+  }
+
+  coroutine_handle<> steal(worker& self) {
+    auto n = workers.size();
+    for(size_t i = 1; i < n; i ++) {
+      auto& victim = *workers[(self.index + i) % n];
+      std::lock_guard<std::mutex> lock(victim.mutex);
+      if(!victim.ready.empty()) {
+        auto handle = victim.ready.front();
+        victim.ready.pop_front();
+        ready_count.fetch_sub(1, std::memory_order_relaxed);
+        return handle;
+      }
+    }
+    return nullptr;
+  }
+
+  /** @brief Pops one due timer, or parks the worker until the next deadline or new work.
+   */
+  coroutine_handle<> wait_timer() {
+    std::unique_lock<std::mutex> lock(timer_mutex);
+    while(!stopped.load(std::memory_order_acquire)) {
+      auto now = tmer.now();
+      if(!timers.empty() && timers.top().awake_at <= now) {
+        return timers.pop();
+      }
+      sleeping.fetch_add(1, std::memory_order_seq_cst);
+      if(ready_count.load(std::memory_order_seq_cst) > 0) {
+        sleeping.fetch_sub(1, std::memory_order_relaxed);
+        return nullptr;
+      }
+      if(timers.empty()) {
+        idle_cv.wait(lock);
+      } else {
+        idle_cv.wait_until(lock, timers.top().awake_at);
+      }
+      sleeping.fetch_sub(1, std::memory_order_relaxed);
+      if(ready_count.load(std::memory_order_acquire) > 0) {
+        return nullptr;
+      }
+    }
+    return nullptr;
+  }
+
+  void work(worker& self) {
+    current_worker = &self;
+    while(!stopped.load(std::memory_order_acquire)) {
+      auto handle = pop_local(self);
+      if(!handle) {
+        handle = steal(self);
+      }
+      if(!handle) {
+        handle = wait_timer();
+      }
+      if(!handle) {
+        continue;
+      }
+      ASYNCIO_TRACE("engine resumes ", handle.address());
+      handle.resume();
+      finish_one();
+    }
+    current_worker = nullptr;
+  }
+
+  void finish_one() noexcept {
+    if(outstanding.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+      std::lock_guard<std::mutex> lock(timer_mutex);
+      stopped.store(true, std::memory_order_release);
+      idle_cv.notify_all();
+    }
+  }
+};
+
+} // namespace asyncio
@@ -0,0 +1,94 @@
+#include <atomic>
+#include <cstdlib>
+#include <iostream>
+#include <new>
+#include "asyncio/coroutine.hpp"
+#include "asyncio/sleep_engine.hpp"
+#include "asyncio/when_all.hpp"
+
+using namespace asyncio;
+
+// Counts every call to the global allocator, including those of coroutine frames that miss the frame pool
+std::atomic<size_t> malloc_count{0};
+
+void* operator new(size_t size) {
+  malloc_count.fetch_add(1, std::memory_order_relaxed);
+  if(void* ptr = std::malloc(size ? size : 1)) {
+    return ptr;
+  }
+  throw std::bad_alloc{};
+}
+
+void operator delete(void* ptr) noexcept {
+  std::free(ptr);
+}
+
+void operator delete(void* ptr, size_t) noexcept {
+  std::free(ptr);
+}
+
+sleep_engine engine;
+
+// Symmetric transfer is only a tail call when optimized: at -O0 every await that completes inline keeps a frame
+// on the stack until control returns to the engine, so the count stays within the stack of unoptimized builds
+constexpr int round_count = 1000;
+
+task<int> leaf(int x) {
+  co_return x + 1;
+}
+
+task<void> leaf_void() {
+  co_return;
+}
+
+task<int> middle(int x) {
+  auto t = leaf(x);
+  co_return co_await t;
+}
+
+task<size_t> await_many() {
+  // Warm up the frame pool and the engine's queue
+  {
+    auto t = middle(0);
+    co_await t;
+    auto v = leaf_void();
+    co_await v;
+    auto a = middle(0);
+    auto b = leaf_void();
+    co_await when_all(a, b);
+  }
+
+  size_t before = malloc_count.load();
+  int sum = 0;
+  for(int i = 0; i < round_count; i ++) {
+    auto t = middle(i);
+    sum += co_await t;
+    auto v = leaf_void();
+    co_await v;
+    auto a = middle(i);
+    auto b = leaf_void();
+    auto [x, _] = co_await when_all(a, b);
+    sum += x;
+  }
+  size_t after = malloc_count.load();
+  std::cout << "sum of " << round_count << " awaited results: " << sum << std::endl;
+  co_return after - before;
+}
+
+int main() {
+  std::cout << "======test allocations per co_await======" << std::endl;
+  auto t = await_many();
+  engine.schedule_task(t);
+  engine.run();
+  auto mallocs = t.result();
+  std::cout << "mallocs during " << round_count * 4 << " co_awaits and " << round_count << " when_all(): " << mallocs << std::endl;
+  if(trace_enabled) {
+    std::cout << "not checked: tracing formats every line on the heap" << std::endl;
+    return 0;
+  }
+  if(mallocs != 0) {
+    std::cout << "co_await of a task or when_all() should not allocate" << std::endl;
+    return 1;
+  }
+  return 0;
+}
@@ -1,17 +1,28 @@
 #include <cstdio>
 #include <string>
 #include <cmath>
+#include <algorithm>
 #include <array>
+#include <iostream>
+#include <thread>
+#include <vector>
+#include <stdexcept>
 #include "asyncio/coroutine.hpp"
 #include "asyncio/sleep_engine.hpp"
+#include "asyncio/async_generator.hpp"
+#include "asyncio/when_all.hpp"
+#include "asyncio/task_group.hpp"
+#include "asyncio/sync.hpp"
+#include "asyncio/channel.hpp"
 
 using namespace asyncio;
+using namespace std::chrono_literals;
 
 sleep_engine engine;
 
 task<void> hello_world() {
   std::cout << "hello ..." << std::endl;
-  co_await engine.sleep(1000);
+  co_await engine.sleep(1000ms);
   std::cout << "... world!" << std::endl;
   co_return;
 }
@@ -32,7 +43,7 @@ task<double> h(task<void>& inner) {
 
 task<int> func() {
   std::cout << "func() starts sleep" << std::endl;
-  co_await engine.sleep(1000);
+  co_await engine.sleep(1000ms);
   std::cout << "func() ends sleep" << std::endl;
 
   auto hello = hello_world();
@@ -44,9 +55,9 @@ task<int> func() {
   auto hello2 = hello_world();
   auto g_task = g(hello2);
   auto h_task = h(hello2);
-  engine.schedule_task(g_task, 1000);
+  engine.schedule_task(g_task, 1000ms);
   std::cout << "func() scheduled g()" << std::endl;
-  engine.schedule_task(h_task, 500);
+  engine.schedule_task(h_task, 500ms);
   std::cout << "func() scheduled h()" << std::endl;
 
   std::cout << "func() starts awaiting g()" << std::endl;
@@ -60,9 +71,302 @@ task<int> func() {
   co_return 5;
 }
 
+task<int> add_one(std::allocator_arg_t, frame_allocator&, int x) {
+  co_await engine.sleep(10ms);
+  co_return x + 1;
+}
+
+task<int> pooled_sum(frame_allocator& pool) {
+  int sum = 0;
+  for(int i = 0; i < 10; i ++) {
+    sum += co_await add_one(std::allocator_arg, pool, i);
+  }
+  co_return sum;
+}
+
+// Hands the caller to another thread, which posts it back to the engine
+struct resume_from_thread: suspend_always {
+  std::thread* worker;
+
+  void await_suspend(coroutine_handle<> caller) {
+    engine.add_work();
+    *worker = std::thread([caller] {
+      std::this_thread::sleep_for(std::chrono::milliseconds(100));
+      std::cout << "another thread posts the caller back" << std::endl;
+      engine.post(caller);
+      engine.remove_work();
+    });
+  }
+};
+
+task<void> cross_thread() {
+  std::thread worker;
+  std::cout << "cross_thread() leaves the engine thread" << std::endl;
+  co_await resume_from_thread{{}, &worker};
+  std::cout << "cross_thread() is back on the engine thread" << std::endl;
+  worker.join();
+}
+
+uint64_t fibonacci(int n) {
+  return n < 2 ? n : fibonacci(n - 1) + fibonacci(n - 2);
+}
+
+task<uint64_t> offload() {
+  std::cout << "offload() sends fibonacci(30) to the pool" << std::endl;
+  auto heartbeat = hello_world();
+  engine.schedule_task(heartbeat);
+  auto ret = co_await engine.run_in_pool([] { return fibonacci(30); });
+  std::cout << "offload() got " << ret << " back on the engine thread" << std::endl;
+  try {
+    co_await engine.run_in_pool([]() -> int { throw std::runtime_error("failed in the pool"); });
+  } catch(const std::runtime_error& e) {
+    std::cout << "offload() caught: " << e.what() << std::endl;
+  }
+  co_await heartbeat;
+  co_return ret;
+}
+
+task<int> fetch_segment(int no) {
+  co_await engine.sleep(10ms);
+  co_return no * 100;
+}
+
+// Fetches segments one by one, so only one is held in memory at a time
+async_generator<int> segments(int count) {
+  for(int no = 0; no < count; no ++) {
+    auto t = fetch_segment(no);
+    co_yield co_await t;
+  }
+  co_await engine.sleep(10ms);
+  throw std::runtime_error("no more segments");
+}
+
+task<int> consume_segments() {
+  auto gen = segments(3);
+  int total = 0;
+  try {
+    while(auto seg = co_await gen.next()) {
+      std::cout << "consume_segments() got segment " << seg.value() << std::endl;
+      total += seg.value();
+    }
+  } catch(const std::runtime_error& e) {
+    std::cout << "consume_segments() caught: " << e.what() << std::endl;
+  }
+  co_return total;
+}
+
+// Waits for the whole Interest lifetime unless cancelled
+task<int> express_interest() {
+  co_await engine.sleep(4000ms);
+  co_return -1;
+}
+
+task<int> fetch_data() {
+  auto interest = express_interest();
+  try {
+    co_return co_await interest;
+  } catch(const operation_cancelled&) {
+    std::cout << "fetch_data() is cancelled" << std::endl;
+  }
+  co_return 0;
+}
+
+task<void> data_arrives(cancellation_source& source) {
+  co_await engine.sleep(50ms);
+  std::cout << "pending timers before cancellation: " << engine.events.size() << std::endl;
+  source.request_cancellation();
+  co_await engine.sleep(1ms);
+  std::cout << "pending timers after cancellation: " << engine.events.size() << std::endl;
+}
+
+// Fetches all segments in parallel, so the total time is one segment's
+task<int> fetch_parallel(int count) {
+  std::vector<task<int>> fetches;
+  for(int no = 0; no < count; no ++) {
+    fetches.push_back(fetch_segment(no));
+  }
+  int total = 0;
+  for(int seg: co_await when_all(fetches)) {
+    total += seg;
+  }
+  auto first = fetch_segment(1);
+  auto second = fetch_segment(2);
+  auto done = hello_world();
+  auto [a, b, _] = co_await when_all(first, second, done);
+  std::cout << "when_all() of three tasks returned " << a << " and " << b << std::endl;
+  co_return total;
+}
+
+// Sends the same Interest to two faces and keeps the first Data
+task<int> fetch_any() {
+  auto slow = express_interest();
+  auto fast = fetch_segment(7);
+  auto winner = co_await when_any(slow, fast);
+  std::cout << "when_any() winner: " << (winner == 1 ? "fast" : "slow") << ", slow one cancelled: ";
+  try {
+    slow.result();
+    std::cout << "no" << std::endl;
+  } catch(const operation_cancelled&) {
+    std::cout << "yes" << std::endl;
+  }
+  co_return fast.result();
+}
+
+// Answered from the content store without suspending
+task<int> lookup_cache(int no) {
+  co_return no * 100;
+}
+
+// A task that is already done, or finishes as soon as it starts, wins over a pending Interest
+task<void> fetch_cached() {
+  auto cached = lookup_cache(3);
+  co_await cached;
+  auto pending = express_interest();
+  auto winner = co_await when_any(pending, cached);
+  std::cout << "when_any() with a finished task, winner: " << winner << std::endl;
+  auto hit = lookup_cache(4);
+  auto again = express_interest();
+  winner = co_await when_any(again, hit);
+  std::cout << "when_any() with a task finishing inline, winner: " << winner << std::endl;
+}
+
+int handled = 0;
+
+task<void> handle_interest(int no) {
+  co_await engine.sleep(std::chrono::milliseconds(no % 10));
+  handled ++;
+}
+
+task<void> bad_interest() {
+  co_await engine.sleep(5ms);
+  throw std::runtime_error("malformed Interest");
+}
+
+// Serves Interests in a group, then cancels a group of long-lived ones
+task<void> serve(int count) {
+  task_group group(engine);
+  for(int no = 0; no < count; no ++) {
+    group.spawn(handle_interest(no));
+  }
+  std::cout << "serve() spawned " << group.size() << " handlers" << std::endl;
+  co_await group.join();
+  std::cout << "serve() joined the handlers" << std::endl;
+
+  for(int no = 0; no < 3; no ++) {
+    group.spawn(express_interest());
+  }
+  group.spawn(bad_interest());
+  try {
+    co_await group.join();
+  } catch(const std::runtime_error& e) {
+    std::cout << "serve() caught: " << e.what() << ", " << group.size() << " handlers left" << std::endl;
+  }
+}
+
+// Hands packets from a face to the application through a channel of 2 packets
+task<void> face_receive(channel<int>& packets) {
+  size_t max_buffered = 0;
+  for(int no = 0; no < 6; no ++) {
+    co_await packets.send(no);
+    max_buffered = std::max(max_buffered, packets.size);
+  }
+  packets.close();
+  std::cout << "face_receive() buffered at most " << max_buffered << " packets" << std::endl;
+}
+
+task<int> app_consume(channel<int>& packets) {
+  int total = 0;
+  while(auto packet = co_await packets.receive()) {
+    co_await engine.sleep(2ms);
+    total += *packet;
+  }
+  co_return total;
+}
+
+int in_flight = 0;
+int max_in_flight = 0;
+
+// At most as many requests in flight as the semaphore allows
+task<void> limited_request(async_semaphore& limit, async_mutex& log_lock, int no) {
+  co_await limit.acquire();
+  in_flight ++;
+  max_in_flight = std::max(max_in_flight, in_flight);
+  co_await engine.sleep(5ms);
+  in_flight --;
+  limit.release();
+  auto guard = co_await log_lock.scoped_lock();
+  co_await engine.sleep(1ms);
+  std::cout << "request " << no << " done" << std::endl;
+}
+
+task<void> wait_ready(async_event& ready, int no) {
+  co_await ready.wait();
+  std::cout << "waiter " << no << " sees the event" << std::endl;
+}
+
+task<void> synchronize() {
+  channel<int> packets(2);
+  auto face = face_receive(packets);
+  auto app = app_consume(packets);
+  auto [_, total] = co_await when_all(face, app);
+  std::cout << "app_consume() got " << total << std::endl;
+
+  task_group group(engine);
+  async_semaphore limit(2);
+  async_mutex log_lock;
+  for(int no = 0; no < 5; no ++) {
+    group.spawn(limited_request(limit, log_lock, no));
+  }
+  co_await group.join();
+  std::cout << "max requests in flight: " << max_in_flight << std::endl;
+
+  async_event ready;
+  for(int no = 0; no < 3; no ++) {
+    group.spawn(wait_ready(ready, no));
+  }
+  co_await engine.sleep(10ms);
+  std::cout << "setting the event" << std::endl;
+  ready.set();
+  co_await group.join();
+
+  // A cancelled receiver leaves the queue
+  channel<int> idle(1);
+  group.spawn([](channel<int>& idle) -> task<void> {
+    try {
+      co_await idle.receive();
+    } catch(const operation_cancelled&) {
+      std::cout << "receive() is cancelled" << std::endl;
+      throw;
+    }
+  }(idle));
+  co_await engine.sleep(1ms);
+  group.cancel();
+  co_await group.join();
+  std::cout << "receivers left waiting: " << !idle.receivers.empty() << std::endl;
+}
+
+std::string resume_order;
+
+task<void> mark(char name) {
+  resume_order += name;
+  co_return;
+}
+
+// Resumed through post() after the pool has run its job
+task<void> offload_urgent() {
+  co_await engine.run_in_pool([] { return fibonacci(20); });
+}
+
+task<int> tick(int count) {
+  for(int i = 0; i < count; i ++) {
+    co_await engine.sleep(1ms);
+  }
+  co_return count;
+}
+
 void transfer_schedule() {
   auto f = func();
-  engine.schedule_task(f, 0);
+  engine.schedule_task(f);
   std::unique_ptr<abstract_task> f_p(new task<int>(std::move(f)));
   engine.transfer_ownership(std::move(f_p));
 }
@@ -70,7 +374,7 @@ void transfer_schedule() {
 int main() {
   auto f = func();
 
-  engine.schedule_task(f, 0);
+  engine.schedule_task(f);
 
   std::cout << "engine started!" << std::endl;
   engine.run();
@@ -82,6 +386,132 @@ int main() {
   engine.run();
   std::cout << "engine finished!" << std::endl;
 
+  std::cout << std::endl << "======test post from another thread======" << std::endl;
+  auto c = cross_thread();
+  engine.schedule_task(c);
+  engine.run();
+  std::cout << "engine finished!" << std::endl;
+
+  std::cout << std::endl << "======test run in pool======" << std::endl;
+  engine.set_pool_size(2);
+  auto o = offload();
+  engine.schedule_task(o);
+  engine.run();
+  auto pool_stats = engine.get_pool().stats();
+  std::cout << "pool jobs submitted: " << pool_stats.submitted
+            << ", max queue depth: " << pool_stats.max_queue_depth << std::endl;
+
+  std::cout << std::endl << "======test async generator======" << std::endl;
+  auto cs = consume_segments();
+  engine.schedule_task(cs);
+  engine.run();
+  std::cout << "consume_segments() returned " << cs.result() << std::endl;
+
+  std::cout << std::endl << "======test cancellation======" << std::endl;
+  cancellation_source source;
+  auto fd = fetch_data();
+  fd.set_cancellation_token(source.token());
+  auto da = data_arrives(source);
+  engine.schedule_task(fd);
+  engine.schedule_task(da);
+  auto start = std::chrono::steady_clock::now();
+  engine.run();
+  std::cout << "fetch_data() returned " << fd.result() << ", without waiting for the Interest lifetime: "
+            << (std::chrono::steady_clock::now() - start < 1s ? "yes" : "no") << std::endl;
+
+  std::cout << std::endl << "======test when_all/when_any======" << std::endl;
+  auto fp = fetch_parallel(50);
+  engine.schedule_task(fp);
+  start = std::chrono::steady_clock::now();
+  engine.run();
+  std::cout << "fetch_parallel() returned " << fp.result() << std::endl;
+  auto fa = fetch_any();
+  engine.schedule_task(fa);
+  engine.run();
+  std::cout << "fetch_any() returned " << fa.result() << ", without waiting for the slow one: "
+            << (std::chrono::steady_clock::now() - start < 2s ? "yes" : "no") << std::endl;
+  auto fc = fetch_cached();
+  engine.schedule_task(fc);
+  start = std::chrono::steady_clock::now();
+  engine.run();
+  std::cout << "fetch_cached() finished without waiting for the Interests: "
+            << (std::chrono::steady_clock::now() - start < 1s ? "yes" : "no") << std::endl;
+
+  std::cout << std::endl << "======test task group======" << std::endl;
+  auto sv = serve(1000);
+  engine.schedule_task(sv);
+  for(int no = 0; no < 1000; no ++) {
+    spawn(engine, handle_interest(no));
+  }
+  start = std::chrono::steady_clock::now();
+  engine.run();
+  sv.result();
+  std::cout << "handled " << handled << " Interests, without waiting for the Interest lifetime: "
+            << (std::chrono::steady_clock::now() - start < 1s ? "yes" : "no") << std::endl;
+
+  std::cout << std::endl << "======test synchronization======" << std::endl;
+  auto sy = synchronize();
+  engine.schedule_task(sy);
+  engine.run();
+  sy.result();
+
+  std::cout << std::endl << "======test priority======" << std::endl;
+  {
+    // Twenty keep-alives (K) due with one bulk (b) and one normal (n) task
+    std::vector<task<void>> marks;
+    marks.push_back(mark('b'));
+    engine.schedule_task(marks.back(), 0ms, priority::low);
+    marks.push_back(mark('n'));
+    engine.schedule_task(marks.back());
+    for(int i = 0; i < 20; i ++) {
+      marks.push_back(mark('K'));
+      engine.schedule_task(marks.back(), 0ms, priority::high);
+    }
+    engine.set_starvation_limit(8);
+    engine.set_latency_metrics(true);
+    engine.run();
+    std::cout << "resume order: " << resume_order << std::endl;
+    for(auto prio: {priority::high, priority::normal, priority::low}) {
+      std::cout << "class " << static_cast<int>(prio) << " resumed " << engine.latency_of(prio).count << std::endl;
+    }
+    engine.set_latency_metrics(false);
+    engine.set_starvation_limit(16);
+  }
+  {
+    auto urgent = offload_urgent();
+    engine.schedule_task(urgent, 0ms, priority::high);
+    engine.reset_latency_metrics();
+    engine.set_latency_metrics(true);
+    engine.run();
+    std::cout << "high-priority resumes around run_in_pool(): " << engine.latency_of(priority::high).count
+              << ", normal: " << engine.latency_of(priority::normal).count << std::endl;
+    engine.set_latency_metrics(false);
+  }
+
+  std::cout << std::endl << "======test wait policy======" << std::endl;
+  for(auto mode: {wait_mode::busy_poll, wait_mode::spin_then_block, wait_mode::block}) {
+    engine.set_wait_policy(wait_policy{mode, 100us});
+    auto t = tick(5);
+    auto c = cross_thread();
+    engine.schedule_task(t);
+    engine.schedule_task(c);
+    engine.run();
+    std::cout << "wait mode " << static_cast<int>(mode) << ": " << t.result() << " ticks" << std::endl;
+  }
+
+  std::cout << std::endl << "======test frame pool======" << std::endl;
+  frame_pool pool;
+  auto s = pooled_sum(pool);
+  engine.schedule_task(s);
+  engine.run();
+  std::cout << "pooled_sum() returned " << s.result() << std::endl;
+  std::cout << "frames allocated from pool: " << pool.stats.allocations
+            << ", reused: " << pool.stats.reused
+            << ", freed: " << pool.stats.deallocations << std::endl;
+  const auto& local = frame_pool::local().stats;
+  std::cout << "frames allocated from thread-local pool: " << local.allocations
+            << ", reused: " << local.reused
+            << ", freed: " << local.deallocations << std::endl;
 
   return 0;
 }
@@ -0,0 +1,54 @@
+#include <cstdio>
+#include <string>
+#include <iostream>
+#include <sys/socket.h>
+#include <unistd.h>
+#include "asyncio/coroutine.hpp"
+#include "asyncio/epoll_engine.hpp"
+
+using namespace asyncio;
+using namespace std::chrono_literals;
+
+epoll_engine engine;
+
+task<std::string> receive(int fd) {
+  std::cout << "receive() waits for fd " << fd << std::endl;
+  co_await engine.readable(fd);
+  char buf[64];
+  auto n = ::read(fd, buf, sizeof(buf));
+  std::cout << "receive() read " << n << " bytes" << std::endl;
+  co_return std::string(buf, n > 0 ? n : 0);
+}
+
+task<void> send_later(int fd, std::string msg) {
+  co_await engine.sleep(100ms);
+  co_await engine.writable(fd);
+  std::cout << "send_later() writes \"" << msg << "\"" << std::endl;
+  ::write(fd, msg.data(), msg.size());
+}
+
+task<int> ping_pong() {
+  int fds[2];
+  if(::socketpair(AF_UNIX, SOCK_DGRAM, 0, fds) < 0) {
+    co_return -1;
+  }
+  auto sender = send_later(fds[1], "ping");
+  engine.schedule_task(sender);
+  auto msg = co_await receive(fds[0]);
+  std::cout << "ping_pong() received \"" << msg << "\"" << std::endl;
+  co_await sender;
+  ::close(fds[0]);
+  ::close(fds[1]);
+  co_return msg == "ping" ? 0 : 1;
+}
+
+int main() {
+  auto t = ping_pong();
+  engine.schedule_task(t);
+
+  std::cout << "engine started!" << std::endl;
+  engine.run();
+  std::cout << "engine finished!" << std::endl;
+
+  return t.result();
+}
@@ -2,7 +2,18 @@
 #include <string>
 #include <cmath>
 #include <array>
+#include <vector>
+#include <iterator>
+#include <algorithm>
+#include <ranges>
+#include <memory>
+#include <stdexcept>
+#include <thread>
+#include <chrono>
+#include <utility>
 #include "asyncio/generator.hpp"
+#include "asyncio/pipeline.hpp"
+#include "asyncio/prefetch.hpp"
 
 using namespace asyncio;
 
@@ -83,6 +94,215 @@ void print_successive_primes(int iterations, int base = 10) {
   }
 }
 
+generator<int> countdown(int n) {
+  while(n > 0) {
+    co_yield n --;
+  }
+}
+
+// Destroyed during static destruction, after the frame pool of the main thread is gone
+std::unique_ptr<generator<int>> kept;
+
+// Yields the leaves of a complete binary tree of the given depth
+generator<int, int> tree(int depth, int label = 0) {
+  if(depth == 0) {
+    co_yield label;
+    co_return 1;
+  }
+  auto left = co_await tree(depth - 1, label * 2);
+  auto right = co_await tree(depth - 1, label * 2 + 1);
+  co_return left + right;
+}
+
+generator<int> failing() {
+  co_yield 1;
+  throw std::runtime_error("failing() throws");
+}
+
+generator<int> catching() {
+  try {
+    co_await failing();
+  } catch(const std::runtime_error& e) {
+    printf("catching() caught: %s\n", e.what());
+  }
+  co_yield 2;
+}
+
+generator<std::string> words(std::string& line) {
+  std::string word;
+  for(char c: line) {
+    if(c == ' ') {
+      co_yield word;
+      word.clear();
+    } else {
+      word += c;
+    }
+  }
+  co_yield word;
+}
+
+void print_words() {
+  std::string line = "yield without copy";
+  // Every word refers to the same local variable in the frame of words()
+  const std::string* first = nullptr;
+  for(auto& word: words(line)) {
+    if(!first) {
+      first = &word;
+    }
+    printf("Word \"%s\" yielded without copy: %s\n", word.c_str(), &word == first ? "yes" : "no");
+  }
+}
+
+// Yields sequence numbers a chunk at a time
+generator<int> sequence(int count, int chunk_size) {
+  std::vector<int> chunk;
+  for(int i = 0; i < count; i += chunk_size) {
+    chunk.clear();
+    for(int j = i; j < std::min(count, i + chunk_size); j ++) {
+      chunk.push_back(j);
+    }
+    co_yield elements_of(chunk);
+  }
+  co_yield 100;
+}
+
+void print_batches() {
+  auto seq = sequence(10, 4);
+  std::array<int, 3> batch;
+  for(size_t n = seq.next_batch(batch); n > 0; n = seq.next_batch(batch)) {
+    printf("Batch:");
+    for(size_t i = 0; i < n; i ++) {
+      printf(" %d", batch[i]);
+    }
+    printf("\n");
+  }
+  std::vector<int> taken;
+  auto seq2 = sequence(5, 2);
+  printf("Took %zu values, ", seq2.take_into(std::back_inserter(taken), 4));
+  printf("then %zu values\n", seq2.take_into(std::back_inserter(taken), 4));
+}
+
+generator<int> inner_part() {
+  co_yield 1;
+  co_yield 2;
+}
+
+generator<int> started_middle() {
+  co_yield 0;
+  co_await inner_part();
+  co_yield 3;
+}
+
+// Yields from generators that have already been partly consumed by next_ref()
+generator<int> resume_started(generator<int>& middle, generator<int>& chunked) {
+  co_await middle;
+  co_await chunked;
+  co_yield 100;
+}
+
+void print_started() {
+  auto middle = started_middle();
+  middle.next_ref();
+  middle.next_ref();
+  auto chunked = sequence(6, 4);
+  chunked.next_ref();
+  printf("Yield from started generators:");
+  for(int v: resume_started(middle, chunked)) {
+    printf(" %d", v);
+  }
+  printf("\n");
+}
+
+generator<int> naturals() {
+  for(int i = 1; ; i ++) {
+    co_yield i;
+  }
+}
+
+void print_pipeline() {
+  auto squares_of_odds = naturals()
+                       | filter([](int x) { return x % 2 == 1; })
+                       | map([](int x) { return x * x; })
+                       | take(5);
+  for(auto v: squares_of_odds) {
+    printf("Pipeline yield with %d\n", v);
+  }
+  auto seq = sequence(7, 2);
+  for(auto batch: seq | map([](int x) { return x * 10; }) | chunk(3)) {
+    printf("Chunk:");
+    for(auto v: batch) {
+      printf(" %d", v);
+    }
+    printf("\n");
+  }
+}
+
+static_assert(std::ranges::input_range<generator<int>>);
+static_assert(std::ranges::view<generator<int, int>>);
+
+void print_ranges() {
+  for(auto v: countdown(6) | std::views::filter([](int x) { return x % 2 == 0; })
+                           | std::views::transform([](int x) { return x * 100; })) {
+    printf("Ranges yield with %d\n", v);
+  }
+  auto primes = naturals() | std::views::filter(is_prime);
+  auto it = std::ranges::find_if(primes, [](int x) { return x > 20; });
+  printf("First prime above 20: %d\n", *it);
+  auto squares = naturals() | map([](int x) { return x * x; });
+  auto big = std::ranges::find_if(squares, [](int x) { return x > 50; });
+  printf("First square above 50: %d\n", *big);
+}
+
+generator<int> slow_squares(int count) {
+  for(int i = 0; i < count; i ++) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    co_yield i * i;
+  }
+  throw std::runtime_error("slow_squares() ran out");
+}
+
+void print_prefetch() {
+  auto producer_thread = std::this_thread::get_id();
+  auto squares = slow_squares(5)
+               | map([&](int x) { return std::pair(x, std::this_thread::get_id() != producer_thread); })
+               | prefetch(2);
+  try {
+    for(auto [v, elsewhere]: squares) {
+      printf("Prefetched %d on another thread: %s\n", v, elsewhere ? "yes" : "no");
+    }
+  } catch(const std::runtime_error& e) {
+    printf("Prefetch caught: %s\n", e.what());
+  }
+  // Stopping early cancels the worker
+  for(auto v: naturals() | prefetch(4) | take(3)) {
+    printf("Prefetched natural %d\n", v);
+  }
+}
+
+void print_tree() {
+  auto t = tree(3);
+  for(auto v: t) {
+    printf("Leaf %d\n", v);
+  }
+  printf("Counted %d leaves\n", t.result());
+  for(auto v: catching()) {
+    printf("Yield with %d\n", v);
+  }
+}
+
+void print_fibers() {
+  // Generators of different types behind one interface
+  std::array<std::unique_ptr<abstract_fiber<int>>, 2> fibers{
+    std::make_unique<fiber<generator<int>>>(countdown(3)),
+    std::make_unique<fiber<generator<int, double>>>(g()),
+  };
+  for(auto& fib: fibers) {
+    for(auto v = fib->next(); v.has_value(); v = fib->next()) {
+      printf("Fiber yield with %d\n", v.value());
+    }
+  }
+}
+
 int main() {
   auto g = f();
   for(auto v = g.next(); v.has_value(); v = g.next()) {
@@ -99,4 +319,32 @@ int main() {
   printf("\n");
 
   print_successive_primes(8);
+  printf("\n");
+
+  print_fibers();
+  printf("\n");
+
+  print_tree();
+  printf("\n");
+
+  print_words();
+  printf("\n");
+
+  print_batches();
+  printf("\n");
+
+  print_started();
+  printf("\n");
+
+  print_pipeline();
+  printf("\n");
+
+  print_ranges();
+  printf("\n");
+
+  print_prefetch();
+  printf("\n");
+
+  kept = std::make_unique<generator<int>>(countdown(3));
+  printf("Generator kept until exit yields %d\n", *kept->next());
 }